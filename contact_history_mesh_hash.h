@@ -0,0 +1,398 @@
+/* ----------------------------------------------------------------------
+    This is the
+
+    ██╗     ██╗ ██████╗  ██████╗  ██████╗ ██╗  ██╗████████╗███████╗
+    ██║     ██║██╔════╝ ██╔════╝ ██╔════╝ ██║  ██║╚══██╔══╝██╔════╝
+    ██║     ██║██║  ███╗██║  ███╗██║  ███╗███████║   ██║   ███████╗
+    ██║     ██║██║   ██║██║   ██║██║   ██║██╔══██║   ██║   ╚════██║
+    ███████╗██║╚██████╔╝╚██████╔╝╚██████╔╝██║  ██║   ██║   ███████║
+    ╚══════╝╚═╝ ╚═════╝  ╚═════╝  ╚═════╝ ╚═╝  ╚═╝   ╚═╝   ╚══════╝®
+
+    DEM simulation engine, released by
+    DCS Computing Gmbh, Linz, Austria
+    http://www.dcs-computing.com, office@dcs-computing.com
+
+    LIGGGHTS® is part of CFDEM®project:
+    http://www.liggghts.com | http://www.cfdem.com
+
+    Core developer and main author:
+    Christoph Kloss, christoph.kloss@dcs-computing.com
+
+    LIGGGHTS® is open-source, distributed under the terms of the GNU Public
+    License, version 2 or later. It is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. You should have
+    received a copy of the GNU General Public License along with LIGGGHTS®.
+    If not, see http://www.gnu.org/licenses . See also top-level README
+    and LICENSE files.
+
+    LIGGGHTS® and CFDEM® are registered trade marks of DCS Computing GmbH,
+    the producer of the LIGGGHTS® software and the CFDEM®coupling software
+    See http://www.cfdem.com/terms-trademark-policy for details.
+
+-------------------------------------------------------------------------
+    Contributing author and copyright for this file:
+    (if not contributing author is listed, this file has been contributed
+    by the core developer)
+
+    Copyright 2012-     DCS Computing GmbH, Linz
+------------------------------------------------------------------------- */
+
+#ifndef LMP_CONTACT_HISTORY_MESH_HASH_H
+#define LMP_CONTACT_HISTORY_MESH_HASH_H
+
+#include "pointers.h"
+#include "atom.h"
+#include "memory.h"
+#include "tri_mesh.h"
+#include "math_extra_liggghts.h"
+
+namespace LAMMPS_NS
+{
+
+  /*
+   * contact history of one mesh wall, alternative to FixContactHistoryMesh
+   *
+   * contacts are stored in an open-addressing hash keyed by (atom tag, triangle id)
+   * each entry carries the generation it was last in contact, beginStep()
+   * counts the generation up, so a contact is alive if it was seen in this or
+   * the previous evaluation, independent of resets of the timestep; there is
+   * no sweep that marks and deletes contacts every step, stale entries are
+   * dropped when the table is compacted, which happens every COMPACT_EVERY
+   * generations or when it fills up
+   *
+   * entries of an atom are chained via next_ so they can be sent along when
+   * the atom migrates, see pack_exchange(); they are not written to restart files
+   */
+
+  class ContactHistoryMeshHash : protected Pointers
+  {
+      public:
+
+        ContactHistoryMeshHash(LAMMPS *lmp, int dnum)
+        : Pointers(lmp), dnum_(dnum), capacity_(0), nUsed_(0), generation_(0), lastCompact_(0),
+          tag_(0), tri_(0), next_(0), intersect_(0), stamp_(0), hist_(0),
+          headTag_(0), head_(0)
+        {
+            allocate(INITIAL_CAPACITY);
+        }
+
+        ~ContactHistoryMeshHash()
+        {
+            deallocate();
+        }
+
+        inline void beginStep();
+        inline bool handleContact(int iPart, int idTri, double *&history, bool intersectflag, bool faceflag, TriMesh *mesh);
+
+        inline int n_contacts(int &nIntersect);
+        inline int n_contacts(int contact_groupbit, int &nIntersect);
+
+        inline int pack_exchange(int i, double *buf);
+        inline int unpack_exchange(int nlocal, double *buf);
+
+      private:
+
+        static const int INITIAL_CAPACITY = 1024;
+        static const int COMPACT_EVERY = 1000;
+
+        int dnum_;
+        int capacity_, nUsed_;
+        bigint generation_, lastCompact_;
+
+        // slots, an empty slot has tag 0
+        int *tag_, *tri_, *next_, *intersect_;
+        bigint *stamp_;
+        double *hist_;
+
+        // first slot of the chain of each atom tag
+        int *headTag_, *head_;
+
+        inline unsigned int hash(int tag, int tri) const
+        {
+            unsigned int h = static_cast<unsigned int>(tag)*2654435761u ^ static_cast<unsigned int>(tri)*2246822519u;
+            return h ^ (h >> 15);
+        }
+
+        inline bool alive(int i, bigint now) const
+        { return stamp_[i] >= now-1; }
+
+        inline int find(int tag, int tri) const;
+        inline int findHead(int tag) const;
+        inline int insert(int tag, int tri, bigint stamp, int intersect);
+        inline void rehash(int capacity);
+        inline bool coplanarContactAlready(int tag, int idTri, bigint now, TriMesh *mesh) const;
+
+        inline void allocate(int capacity);
+        inline void deallocate();
+  };
+
+  /*
+   * implementation of class ContactHistoryMeshHash starts here
+   */
+
+  void ContactHistoryMeshHash::allocate(int capacity)
+  {
+    capacity_ = capacity;
+    nUsed_ = 0;
+    memory->create(tag_,capacity_,"ContactHistoryMeshHash:tag_");
+    memory->create(tri_,capacity_,"ContactHistoryMeshHash:tri_");
+    memory->create(next_,capacity_,"ContactHistoryMeshHash:next_");
+    memory->create(intersect_,capacity_,"ContactHistoryMeshHash:intersect_");
+    memory->create(stamp_,capacity_,"ContactHistoryMeshHash:stamp_");
+    memory->create(hist_,capacity_*(dnum_ > 0 ? dnum_ : 1),"ContactHistoryMeshHash:hist_");
+    memory->create(headTag_,capacity_,"ContactHistoryMeshHash:headTag_");
+    memory->create(head_,capacity_,"ContactHistoryMeshHash:head_");
+    for(int i = 0; i < capacity_; i++)
+      tag_[i] = headTag_[i] = 0;
+  }
+
+  void ContactHistoryMeshHash::deallocate()
+  {
+    memory->destroy(tag_);
+    memory->destroy(tri_);
+    memory->destroy(next_);
+    memory->destroy(intersect_);
+    memory->destroy(stamp_);
+    memory->destroy(hist_);
+    memory->destroy(headTag_);
+    memory->destroy(head_);
+  }
+
+  int ContactHistoryMeshHash::find(int tag, int tri) const
+  {
+    const int mask = capacity_-1;
+    for(int i = hash(tag,tri) & mask; tag_[i] != 0; i = (i+1) & mask)
+      if(tag_[i] == tag && tri_[i] == tri)
+        return i;
+    return -1;
+  }
+
+  int ContactHistoryMeshHash::findHead(int tag) const
+  {
+    const int mask = capacity_-1;
+    for(int h = hash(tag,0) & mask; headTag_[h] != 0; h = (h+1) & mask)
+      if(headTag_[h] == tag)
+        return h;
+    return -1;
+  }
+
+  // adds a slot for a key that is not in the table, history is not initialized
+  int ContactHistoryMeshHash::insert(int tag, int tri, bigint stamp, int intersect)
+  {
+    // keep the load factor below 1/2, drop stale entries first
+    if(2*(nUsed_+1) > capacity_)
+      rehash(capacity_);
+
+    const int mask = capacity_-1;
+    int i = hash(tag,tri) & mask;
+    while(tag_[i] != 0)
+      i = (i+1) & mask;
+
+    int h = hash(tag,0) & mask;
+    while(headTag_[h] != 0 && headTag_[h] != tag)
+      h = (h+1) & mask;
+    if(headTag_[h] == 0)
+    {
+      headTag_[h] = tag;
+      head_[h] = -1;
+    }
+
+    tag_[i] = tag;
+    tri_[i] = tri;
+    stamp_[i] = stamp;
+    intersect_[i] = intersect;
+    next_[i] = head_[h];
+    head_[h] = i;
+    nUsed_++;
+    return i;
+  }
+
+  // rebuilds the table with the alive entries, grows it if they fill
+  // more than a quarter of the requested capacity
+  void ContactHistoryMeshHash::rehash(int capacity)
+  {
+    const bigint now = generation_;
+
+    int nAlive = 0;
+    for(int i = 0; i < capacity_; i++)
+      if(tag_[i] != 0 && alive(i,now))
+        nAlive++;
+    while(4*(nAlive+1) > capacity)
+      capacity *= 2;
+
+    const int oldCapacity = capacity_;
+    int *oldTag = tag_, *oldTri = tri_, *oldIntersect = intersect_;
+    bigint *oldStamp = stamp_;
+    double *oldHist = hist_;
+    int *oldNext = next_, *oldHeadTag = headTag_, *oldHead = head_;
+
+    tag_ = tri_ = next_ = intersect_ = headTag_ = head_ = 0;
+    stamp_ = 0;
+    hist_ = 0;
+    allocate(capacity);
+
+    for(int i = 0; i < oldCapacity; i++)
+    {
+      if(oldTag[i] == 0 || oldStamp[i] < now-1) continue;
+      const int j = insert(oldTag[i],oldTri[i],oldStamp[i],oldIntersect[i]);
+      for(int k = 0; k < dnum_; k++)
+        hist_[j*dnum_+k] = oldHist[i*dnum_+k];
+    }
+
+    memory->destroy(oldTag);
+    memory->destroy(oldTri);
+    memory->destroy(oldNext);
+    memory->destroy(oldIntersect);
+    memory->destroy(oldStamp);
+    memory->destroy(oldHist);
+    memory->destroy(oldHeadTag);
+    memory->destroy(oldHead);
+
+    lastCompact_ = now;
+  }
+
+  // replaces markAllContacts(), only compacts from time to time
+  void ContactHistoryMeshHash::beginStep()
+  {
+    generation_++;
+    if(nUsed_ > 0 && generation_ - lastCompact_ >= COMPACT_EVERY)
+      rehash(capacity_);
+  }
+
+  // true if the particle already touches a coplanar neighbor of idTri in this step
+  bool ContactHistoryMeshHash::coplanarContactAlready(int tag, int idTri, bigint now, TriMesh *mesh) const
+  {
+    const int h = findHead(tag);
+    if(h < 0) return false;
+    for(int i = head_[h]; i >= 0; i = next_[i])
+      if(stamp_[i] == now && tri_[i] != idTri && mesh->areCoplNeighs(tri_[i],idTri))
+        return true;
+    return false;
+  }
+
+  /*
+   * sets history to the contact of particle iPart with triangle idTri,
+   * new contacts start with zero history
+   * a new edge or corner contact is not added if the particle already
+   * touches a coplanar neighbor triangle in this step, returns false then
+   */
+
+  bool ContactHistoryMeshHash::handleContact(int iPart, int idTri, double *&history, bool intersectflag, bool faceflag, TriMesh *mesh)
+  {
+    const int tag = atom->tag[iPart];
+    const bigint now = generation_;
+
+    int i = find(tag,idTri);
+    if(i >= 0 && alive(i,now))
+    {
+      stamp_[i] = now;
+      intersect_[i] = intersectflag ? 1 : 0;
+      history = dnum_ > 0 ? &hist_[i*dnum_] : 0;
+      return true;
+    }
+
+    if(!faceflag && coplanarContactAlready(tag,idTri,now,mesh))
+      return false;
+
+    if(i < 0)
+      i = insert(tag,idTri,now,intersectflag ? 1 : 0);
+    else
+    {
+      stamp_[i] = now;
+      intersect_[i] = intersectflag ? 1 : 0;
+    }
+
+    for(int k = 0; k < dnum_; k++)
+      hist_[i*dnum_+k] = 0.;
+    history = dnum_ > 0 ? &hist_[i*dnum_] : 0;
+    return true;
+  }
+
+  int ContactHistoryMeshHash::n_contacts(int &nIntersect)
+  {
+    const bigint now = generation_;
+    int ncontacts = 0;
+    nIntersect = 0;
+    for(int i = 0; i < capacity_; i++)
+    {
+      if(tag_[i] == 0 || stamp_[i] != now) continue;
+      ncontacts++;
+      if(intersect_[i]) nIntersect++;
+    }
+    return ncontacts;
+  }
+
+  // contacts of particles in the group, needs an atom map
+  int ContactHistoryMeshHash::n_contacts(int contact_groupbit, int &nIntersect)
+  {
+    const bigint now = generation_;
+    int *mask = atom->mask;
+    int ncontacts = 0;
+    nIntersect = 0;
+    for(int i = 0; i < capacity_; i++)
+    {
+      if(tag_[i] == 0 || stamp_[i] != now) continue;
+      const int iPart = atom->map(tag_[i]);
+      if(iPart < 0 || !(mask[iPart] & contact_groupbit)) continue;
+      ncontacts++;
+      if(intersect_[i]) nIntersect++;
+    }
+    return ncontacts;
+  }
+
+  // packs the alive contacts of atom i and drops them locally
+  // the generation is sent relative to the current one, the counters
+  // of the procs need not agree
+  int ContactHistoryMeshHash::pack_exchange(int i, double *buf)
+  {
+    const bigint now = generation_;
+    int m = 1;
+    int n = 0;
+
+    const int h = findHead(atom->tag[i]);
+    if(h >= 0)
+    {
+      for(int j = head_[h]; j >= 0; j = next_[j])
+      {
+        if(!alive(j,now)) continue;
+        buf[m++] = static_cast<double>(tri_[j]);
+        buf[m++] = static_cast<double>(now - stamp_[j]);
+        buf[m++] = static_cast<double>(intersect_[j]);
+        for(int k = 0; k < dnum_; k++)
+          buf[m++] = hist_[j*dnum_+k];
+        stamp_[j] = -1;
+        n++;
+      }
+    }
+    buf[0] = static_cast<double>(n);
+    return m;
+  }
+
+  int ContactHistoryMeshHash::unpack_exchange(int nlocal, double *buf)
+  {
+    const int tag = atom->tag[nlocal];
+    const int n = static_cast<int>(buf[0]);
+    int m = 1;
+
+    for(int c = 0; c < n; c++)
+    {
+      const int tri = static_cast<int>(buf[m++]);
+      const bigint stamp = generation_ - static_cast<bigint>(buf[m++]);
+      const int intersect = static_cast<int>(buf[m++]);
+      int j = find(tag,tri);
+      if(j < 0)
+        j = insert(tag,tri,stamp,intersect);
+      else
+      {
+        stamp_[j] = stamp;
+        intersect_[j] = intersect;
+      }
+      for(int k = 0; k < dnum_; k++)
+        hist_[j*dnum_+k] = buf[m++];
+    }
+    return m;
+  }
+
+} /* namespace LAMMPS_NS */
+#endif /* LMP_CONTACT_HISTORY_MESH_HASH_H */
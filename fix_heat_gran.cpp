@@ -42,14 +42,25 @@
 #include "fix_heat_gran.h"
 
 #include "atom.h"
+#include "comm.h"
+#include "error.h"
 #include "fix_property_atom.h"
+#include "fix_property_global.h"
+#include "fix_rigid.h"
 #include "fix_scalar_transport_equation.h"
 #include "force.h"
 #include "group.h"
 #include "math_extra.h"
+#include "memory.h"
 #include "modify.h"
+#include "neighbor.h"
 #include "pair_gran.h"
+#include "properties.h"
+#include "update.h"
+#include "mpi_liggghts.h"
 #include <stdlib.h>
+#include <cmath>
+#include <algorithm>
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -72,6 +83,36 @@ FixHeatGran::FixHeatGran(LAMMPS *lmp, int narg, char **arg) : Fix(lmp, narg, arg
   fix_temp = fix_heatFlux = fix_heatSource = NULL;
   fix_ste = NULL;
   fix_directionalHeatFlux = NULL;
+  directionalHeatFlux = NULL;
+  directional_flux_ = false;
+  lumped_bodies_ = false;
+  fix_rigid_ = NULL;
+  fix_body_tag_ = NULL;
+  body_tag_ = NULL;
+  body_tag_build_ = -1;
+  capacity_ = NULL;
+  body_temp_ = body_cap_ = NULL;
+  body_sum_local_ = body_sum_ = NULL;
+  nbody_ = 0;
+  body_owner_ = body_rank_ = NULL;
+  body_split_ = body_local_ = NULL;
+  nbody_split_ = nbody_local_ = 0;
+  body_split_sum_ = NULL;
+  body_split_build_ = -1;
+  replay_ = false;
+  integrator_ = INTEGRATOR_STE;
+  flux_pending_ = false;
+  thermal_control_ = false;
+  thermal_safety_ = 0.5;
+  thermal_max_span_ = 1;
+  dt_thermal_crit_ = 0.;
+  thermal_span_ = thermal_subcycles_ = 1;
+  last_thermal_step_ = -1;
+  subcycle_warned_ = false;
+  accumulate_conductance_ = false;
+  conductance_ = NULL;
+  nmax_conductance_ = 0;
+  conductance_step_ = -1;
   peratom_flag = 1;      
   size_peratom_cols = 0; 
   peratom_freq = 1;
@@ -84,11 +125,31 @@ FixHeatGran::FixHeatGran(LAMMPS *lmp, int narg, char **arg) : Fix(lmp, narg, arg
 
 /* ---------------------------------------------------------------------- */
 
+FixHeatGran::~FixHeatGran()
+{
+  memory->destroy(capacity_);
+  memory->destroy(body_temp_);
+  memory->destroy(body_cap_);
+  memory->destroy(body_sum_local_);
+  memory->destroy(body_sum_);
+  memory->destroy(body_owner_);
+  memory->destroy(body_rank_);
+  memory->destroy(body_split_);
+  memory->destroy(body_local_);
+  memory->destroy(body_split_sum_);
+  memory->destroy(conductance_);
+}
+
+/* ---------------------------------------------------------------------- */
+
 void FixHeatGran::post_create()
 {
-  // register directional flux
+  // register directional flux only if it is requested or
+  // if it was already defined by another command that uses it
   fix_directionalHeatFlux = static_cast<FixPropertyAtom*>(modify->find_fix_property("directionalHeatFlux","property/atom","vector",3,0,this->style,false));
-  if(!fix_directionalHeatFlux)
+  if(fix_directionalHeatFlux)
+    directional_flux_ = true;
+  else if(directional_flux_)
   {
     const char* fixarg[11];
     fixarg[0]="directionalHeatFlux";
@@ -105,36 +166,91 @@ void FixHeatGran::post_create()
     fix_directionalHeatFlux = modify->add_fix_property_atom(11,const_cast<char**>(fixarg),style);
   }
 
-  fix_ste = modify->find_fix_scalar_transport_equation("heattransfer");
-  if(!fix_ste)
+  // fused integrator: this fix owns the temperature fields
+  // pending fluxes are integrated before a restart file is written
+  if(INTEGRATOR_STE != integrator_)
   {
-    const char * newarg[15];
-    newarg[0] = "ste_heattransfer";
-    newarg[1] = group->names[igroup];
-    newarg[2] = "transportequation/scalar";
-    newarg[3] = "equation_id";
-    newarg[4] = "heattransfer";
-    newarg[5] = "quantity";
-    newarg[6] = "Temp";
-    newarg[7] = "default_value";
+    restart_global = 1;
+
+    if(modify->find_fix_scalar_transport_equation("heattransfer"))
+      error->fix_error(FLERR,this,"can not use 'integrator explicit' or 'integrator implicit' together with "
+                                  "a fix transportequation/scalar for heattransfer");
+
     char arg8[30];
     sprintf(arg8,"%f",T0);
-    newarg[8] = arg8;
-    newarg[9] = "flux_quantity";
-    newarg[10] = "heatFlux";
-    newarg[11] = "source_quantity";
-    newarg[12] = "heatSource";
-    newarg[13] = "capacity_quantity";
-    newarg[14] = "thermalCapacity";
-    modify->add_fix(15,(char**)newarg);
+    const char *names[3] = {"Temp","heatFlux","heatSource"};
+    const char *restart[3] = {"yes","no","no"};
+    for(int k = 0; k < 3; k++)
+    {
+      if(modify->find_fix_property(names[k],"property/atom","scalar",0,0,this->style,false))
+        continue;
+      const char* fixarg[9];
+      fixarg[0]=names[k];
+      fixarg[1]="all";
+      fixarg[2]="property/atom";
+      fixarg[3]=names[k];
+      fixarg[4]="scalar";
+      fixarg[5]=restart[k];
+      fixarg[6]="yes";
+      fixarg[7]="no";
+      fixarg[8]= (k == 0) ? arg8 : "0.";
+      modify->add_fix_property_atom(9,const_cast<char**>(fixarg),style);
+    }
+  }
+  else
+  {
+    fix_ste = modify->find_fix_scalar_transport_equation("heattransfer");
+    if(!fix_ste)
+    {
+      const char * newarg[15];
+      newarg[0] = "ste_heattransfer";
+      newarg[1] = group->names[igroup];
+      newarg[2] = "transportequation/scalar";
+      newarg[3] = "equation_id";
+      newarg[4] = "heattransfer";
+      newarg[5] = "quantity";
+      newarg[6] = "Temp";
+      newarg[7] = "default_value";
+      char arg8[30];
+      sprintf(arg8,"%f",T0);
+      newarg[8] = arg8;
+      newarg[9] = "flux_quantity";
+      newarg[10] = "heatFlux";
+      newarg[11] = "source_quantity";
+      newarg[12] = "heatSource";
+      newarg[13] = "capacity_quantity";
+      newarg[14] = "thermalCapacity";
+      modify->add_fix(15,(char**)newarg);
+    }
+  }
+
+  // rigid body of each sphere for lumped mode, communicated to ghosts
+  if(lumped_bodies_)
+  {
+    fix_body_tag_ = static_cast<FixPropertyAtom*>(modify->find_fix_property("lumpedBody","property/atom","scalar",0,0,this->style,false));
+    if(!fix_body_tag_)
+    {
+      const char* fixarg[9];
+      fixarg[0]="lumpedBody";
+      fixarg[1]="all";
+      fixarg[2]="property/atom";
+      fixarg[3]="lumpedBody";
+      fixarg[4]="scalar";
+      fixarg[5]="no";
+      fixarg[6]="yes";
+      fixarg[7]="no";
+      fixarg[8]="0.";
+      fix_body_tag_ = modify->add_fix_property_atom(9,const_cast<char**>(fixarg),style);
+    }
   }
 
   fix_temp = static_cast<FixPropertyAtom*>(modify->find_fix_property("Temp","property/atom","scalar",0,0,style));
   fix_heatFlux = static_cast<FixPropertyAtom*>(modify->find_fix_property("heatFlux","property/atom","scalar",0,0,style));
   fix_heatSource = static_cast<FixPropertyAtom*>(modify->find_fix_property("heatSource","property/atom","scalar",0,0,style));
-  fix_directionalHeatFlux = static_cast<FixPropertyAtom*>(modify->find_fix_property("directionalHeatFlux","property/atom","vector",0,0,style));
+  if(directional_flux_)
+    fix_directionalHeatFlux = static_cast<FixPropertyAtom*>(modify->find_fix_property("directionalHeatFlux","property/atom","vector",0,0,style));
 
-  if(!fix_temp || !fix_heatFlux || !fix_heatSource || !fix_directionalHeatFlux)
+  if(!fix_temp || !fix_heatFlux || !fix_heatSource || (directional_flux_ && !fix_directionalHeatFlux))
     error->one(FLERR,"internal error");
 }
 
@@ -147,7 +263,10 @@ void FixHeatGran::updatePtrs()
 
   heatFlux = fix_heatFlux->vector_atom;
   heatSource = fix_heatSource->vector_atom;
-  directionalHeatFlux = fix_directionalHeatFlux->array_atom;
+  if(directional_flux_)
+    directionalHeatFlux = fix_directionalHeatFlux->array_atom;
+  if(lumped_bodies_)
+    body_tag_ = fix_body_tag_->vector_atom;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -162,24 +281,273 @@ void FixHeatGran::init()
   if(modify->n_fixes_style(style) > 1)
     error->fix_error(FLERR,this,"cannot have more than one fix of this style");
 
-  if(!force->pair_match("gran", 0))
+  if(!replay_ && !force->pair_match("gran", 0))
     error->fix_error(FLERR,this,"needs a granular pair style to be used");
 
   pair_gran = static_cast<PairGran*>(force->pair_match("gran", 0));
-  history_flag = pair_gran->is_history();
+  history_flag = pair_gran ? pair_gran->is_history() : 0;
 
-  fix_ste = modify->find_fix_scalar_transport_equation("heattransfer");
-  if(!fix_ste) error->fix_error(FLERR,this,"needs a fix transportequation/scalar to work with");
+  if(INTEGRATOR_STE == integrator_)
+  {
+    fix_ste = modify->find_fix_scalar_transport_equation("heattransfer");
+    if(!fix_ste) error->fix_error(FLERR,this,"needs a fix transportequation/scalar to work with");
+  }
 
   fix_temp = static_cast<FixPropertyAtom*>(modify->find_fix_property("Temp","property/atom","scalar",0,0,style));
   fix_heatFlux = static_cast<FixPropertyAtom*>(modify->find_fix_property("heatFlux","property/atom","scalar",0,0,style));
   fix_heatSource = static_cast<FixPropertyAtom*>(modify->find_fix_property("heatSource","property/atom","scalar",0,0,style));
-  fix_directionalHeatFlux = static_cast<FixPropertyAtom*>(modify->find_fix_property("directionalHeatFlux","property/atom","vector",0,0,style));
 
-  if(!fix_temp || !fix_heatFlux || !fix_heatSource || !fix_directionalHeatFlux)
+  // a command defined after this fix may consume the directional flux
+  fix_directionalHeatFlux = static_cast<FixPropertyAtom*>(modify->find_fix_property("directionalHeatFlux","property/atom","vector",0,0,style,false));
+  if(fix_directionalHeatFlux)
+    directional_flux_ = true;
+
+  if(!fix_temp || !fix_heatFlux || !fix_heatSource || (directional_flux_ && !fix_directionalHeatFlux))
     error->one(FLERR,"internal error");
 
   updatePtrs();
+
+  // thermal capacity per type for lumped bodies, timestep control
+  // and the fused integrator
+  if(lumped_bodies_ || thermal_control_ || INTEGRATOR_STE != integrator_)
+  {
+    int max_type = atom->get_properties()->max_type();
+    FixPropertyGlobal *fix_capacity =
+      static_cast<FixPropertyGlobal*>(modify->find_fix_property("thermalCapacity","property/global","peratomtype",max_type,0,style));
+    memory->destroy(capacity_);
+    memory->create(capacity_,max_type,"heat/gran:capacity_");
+    for(int i = 0; i < max_type; i++)
+      capacity_[i] = fix_capacity->compute_vector(i);
+  }
+
+  // fluxes added during setup are not integrated, as with
+  // fix transportequation/scalar
+  flux_pending_ = false;
+
+  // critical thermal step is unknown until the first evaluation
+  if(thermal_control_)
+  {
+    dt_thermal_crit_ = 0.;
+    thermal_span_ = thermal_subcycles_ = 1;
+    last_thermal_step_ = -1;
+  }
+
+  if(lumped_bodies_)
+  {
+    fix_rigid_ = static_cast<FixRigid*>(modify->find_fix_style_strict("rigid",0));
+    if(!fix_rigid_)
+      error->fix_error(FLERR,this,"'lumped_bodies' requires a fix rigid");
+    int dim;
+    if(!fix_rigid_->extract("body",dim))
+      error->fix_error(FLERR,this,"'lumped_bodies' can not access the bodies of the fix rigid");
+
+    fix_body_tag_ = static_cast<FixPropertyAtom*>(modify->find_fix_property("lumpedBody","property/atom","scalar",0,0,style));
+    set_body_tags();
+    body_tag_build_ = -1;
+
+    // bodies are numbered consecutively by fix rigid
+    int *body = static_cast<int*>(fix_rigid_->extract("body",dim));
+    nbody_ = 0;
+    for(int i = 0; i < atom->nlocal; i++)
+      nbody_ = std::max(nbody_,body[i]+1);
+    MPI_Max_Scalar(nbody_,world);
+
+    memory->destroy(body_temp_);
+    memory->destroy(body_cap_);
+    memory->destroy(body_sum_local_);
+    memory->destroy(body_sum_);
+    memory->create(body_temp_,nbody_,"heat/gran:body_temp_");
+    memory->create(body_cap_,nbody_,"heat/gran:body_cap_");
+    memory->create(body_sum_local_,2*nbody_,"heat/gran:body_sum_local_");
+    memory->create(body_sum_,2*nbody_,"heat/gran:body_sum_");
+    memory->destroy(body_owner_);
+    memory->destroy(body_rank_);
+    memory->destroy(body_split_);
+    memory->destroy(body_local_);
+    memory->destroy(body_split_sum_);
+    memory->create(body_owner_,nbody_,"heat/gran:body_owner_");
+    memory->create(body_rank_,nbody_,"heat/gran:body_rank_");
+    memory->create(body_split_,nbody_,"heat/gran:body_split_");
+    memory->create(body_local_,nbody_,"heat/gran:body_local_");
+    memory->create(body_split_sum_,2*nbody_,"heat/gran:body_split_sum_");
+
+    lump_body_temperatures();
+  }
+}
+
+/* ----------------------------------------------------------------------
+   body tags of owned spheres, from the body index of fix rigid
+------------------------------------------------------------------------- */
+
+void FixHeatGran::set_body_tags()
+{
+  int dim;
+  int *body = static_cast<int*>(fix_rigid_->extract("body",dim));
+  double *tag = fix_body_tag_->vector_atom;
+  int nlocal = atom->nlocal;
+
+  for(int i = 0; i < nlocal; i++)
+    tag[i] = body[i] >= 0 ? static_cast<double>(body[i]+1) : 0.;
+  body_tag_ = tag;
+}
+
+/* ----------------------------------------------------------------------
+   body tags of ghost spheres are set after each neighbor list build
+------------------------------------------------------------------------- */
+
+void FixHeatGran::refresh_body_tags()
+{
+  set_body_tags();
+  fix_body_tag_->do_forward_comm();
+  body_tag_build_ = neighbor->lastcall;
+}
+
+/* ----------------------------------------------------------------------
+   body temperature is the capacity-weighted mean temperature of its
+   spheres, body capacities are constant during a run
+------------------------------------------------------------------------- */
+
+void FixHeatGran::lump_body_temperatures()
+{
+  double *rmass = atom->rmass;
+  int *type = atom->type;
+  int nlocal = atom->nlocal;
+
+  for(int b = 0; b < 2*nbody_; b++)
+    body_sum_local_[b] = 0.;
+
+  for(int i = 0; i < nlocal; i++)
+  {
+    const int b = static_cast<int>(body_tag_[i]) - 1;
+    if(b < 0) continue;
+    const double mc = rmass[i]*capacity_[type[i]-1];
+    body_sum_local_[2*b] += mc*Temp[i];
+    body_sum_local_[2*b+1] += mc;
+  }
+
+  MPI_Allreduce(body_sum_local_,body_sum_,2*nbody_,MPI_DOUBLE,MPI_SUM,world);
+
+  // all ranks have all body temperatures now
+  for(int b = 0; b < nbody_; b++)
+  {
+    body_cap_[b] = body_sum_[2*b+1];
+    body_temp_[b] = body_cap_[b] > 0. ? body_sum_[2*b]/body_cap_[b] : T0;
+    body_owner_[b] = 0;
+  }
+  body_split_build_ = -1;
+
+  for(int i = 0; i < nlocal; i++)
+  {
+    const int b = static_cast<int>(body_tag_[i]) - 1;
+    if(b >= 0) Temp[i] = body_temp_[b];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   find the bodies with spheres on this rank and the bodies split across
+   ranks, called once after each neighbor list build, when atoms migrate
+   two reductions of nbody values: the temperature of each body is taken
+   from its previous owner, and the ranks holding each body are counted
+------------------------------------------------------------------------- */
+
+void FixHeatGran::update_body_partition()
+{
+  int nlocal = atom->nlocal;
+  const int me = comm->me;
+
+  for(int b = 0; b < nbody_; b++)
+    body_rank_[b] = -1;
+  for(int i = 0; i < nlocal; i++)
+  {
+    const int b = static_cast<int>(body_tag_[i]) - 1;
+    if(b >= 0) body_rank_[b] = me;
+  }
+
+  for(int b = 0; b < nbody_; b++)
+  {
+    body_sum_local_[2*b] = body_rank_[b] >= 0 ? 1. : 0.;
+    body_sum_local_[2*b+1] = body_owner_[b] == me ? body_temp_[b] : 0.;
+  }
+  MPI_Allreduce(body_sum_local_,body_sum_,2*nbody_,MPI_DOUBLE,MPI_SUM,world);
+
+  nbody_split_ = nbody_local_ = 0;
+  for(int b = 0; b < nbody_; b++)
+  {
+    body_temp_[b] = body_sum_[2*b+1];
+    if(body_sum_[2*b] > 1.5)
+      body_split_[nbody_split_++] = b;
+    if(body_rank_[b] >= 0)
+      body_local_[nbody_local_++] = b;
+  }
+
+  // the highest rank holding a body owns it, bodies without spheres
+  // stay with their previous owner
+  MPI_Allreduce(body_rank_,body_owner_,nbody_,MPI_INT,MPI_MAX,world);
+  for(int b = 0; b < nbody_; b++)
+    if(body_owner_[b] < 0)
+      body_owner_[b] = 0;
+
+  body_split_build_ = neighbor->lastcall;
+}
+
+/* ----------------------------------------------------------------------
+   advance the body temperatures by one step with the heat rates of all
+   their spheres; the implicit variant uses the conductance sum of the body
+   only the bodies of this rank are updated, sums of bodies that are split
+   across ranks are reduced, one or two values per split body and step
+------------------------------------------------------------------------- */
+
+void FixHeatGran::integrate_body_temperatures(bool implicit)
+{
+  int nlocal = atom->nlocal;
+  const double dt = update->dt;
+  const int nval = implicit ? 2 : 1;
+
+  if(body_split_build_ != neighbor->lastcall)
+    update_body_partition();
+
+  for(int k = 0; k < nbody_local_; k++)
+  {
+    const int b = body_local_[k];
+    for(int v = 0; v < nval; v++)
+      body_sum_local_[nval*b+v] = 0.;
+  }
+
+  for(int i = 0; i < nlocal; i++)
+  {
+    const int b = static_cast<int>(body_tag_[i]) - 1;
+    if(b < 0) continue;
+    body_sum_local_[nval*b] += heatFlux[i] + heatSource[i];
+    if(implicit)
+      body_sum_local_[nval*b+1] += conductance_[i];
+  }
+
+  if(nbody_split_ > 0)
+  {
+    for(int k = 0; k < nbody_split_; k++)
+    {
+      const int b = body_split_[k];
+      for(int v = 0; v < nval; v++)
+        body_sum_[nval*k+v] = body_rank_[b] >= 0 ? body_sum_local_[nval*b+v] : 0.;
+    }
+
+    MPI_Allreduce(body_sum_,body_split_sum_,nval*nbody_split_,MPI_DOUBLE,MPI_SUM,world);
+
+    for(int k = 0; k < nbody_split_; k++)
+    {
+      const int b = body_split_[k];
+      for(int v = 0; v < nval; v++)
+        body_sum_local_[nval*b+v] = body_split_sum_[nval*k+v];
+    }
+  }
+
+  for(int k = 0; k < nbody_local_; k++)
+  {
+    const int b = body_local_[k];
+    if(body_cap_[b] <= 0.) continue;
+    const double denom = implicit ? body_cap_[b] + dt*body_sum_local_[nval*b+1] : body_cap_[b];
+    body_temp_[b] += body_sum_local_[nval*b]*dt/denom;
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -188,6 +556,8 @@ int FixHeatGran::setmask()
 {
   int mask = 0;
   mask |= INITIAL_INTEGRATE;
+  if(lumped_bodies_ && INTEGRATOR_STE == integrator_) mask |= FINAL_INTEGRATE;
+  if(lumped_bodies_ || INTEGRATOR_STE != integrator_) mask |= PRE_FORCE;
   return mask;
 }
 
@@ -199,29 +569,270 @@ void FixHeatGran::initial_integrate(int vflag)
 
   //reset heat flux
   //sources are not reset
-  //int *mask = atom->mask;
+
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+
+  // fused integrator: the fluxes of the previous step are integrated
+  // and reset in the same sweep, unless they were already integrated
+  // at the end of the last run or before a restart file was written
+  if(INTEGRATOR_STE != integrator_)
+  {
+    if(flux_pending_)
+      integrate_temperature(INTEGRATOR_IMPLICIT == integrator_ && conductance_step_ == update->ntimestep-1);
+    else
+    {
+      for (int i = 0; i < nall; i++)
+        heatFlux[i] = 0.;
+    }
+    flux_pending_ = true;
+  }
+
+  if(!directional_flux_) return;
+
+  // ghosts are reset locally, so no forward communication is needed
+
+  for (int i = 0; i < nall; i++)
+  {
+    directionalHeatFlux[i][0] = 0.;
+    directionalHeatFlux[i][1] = 0.;
+    directionalHeatFlux[i][2] = 0.;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   fused integrator: advance Temp with the accumulated fluxes and reset them
+   the implicit variant linearizes the flux with respect to the own
+   temperature using the conductance sum G of the particle
+------------------------------------------------------------------------- */
+
+void FixHeatGran::integrate_temperature(bool implicit)
+{
   int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  double *rmass = atom->rmass;
+  int *type = atom->type;
+  int *mask = atom->mask;
+  const double dt = update->dt;
+
+  // spheres of a lumped body take the body temperature
+  // ghosts get it with the forward communication in pre_force()
+  if(lumped_bodies_)
+  {
+    integrate_body_temperatures(implicit);
+    for (int i = 0; i < nlocal; i++)
+    {
+      const int b = static_cast<int>(body_tag_[i]) - 1;
+      if(b >= 0) Temp[i] = body_temp_[b];
+    }
+  }
 
   for (int i = 0; i < nlocal; i++)
   {
+    if(lumped_bodies_ && body_tag_[i] > 0.)
+    {
+      heatFlux[i] = 0.;
+      continue;
+    }
+    if(mask[i] & groupbit)
+    {
+      const double mc = rmass[i]*capacity_[type[i]-1];
+      const double denom = implicit ? mc + dt*conductance_[i] : mc;
+      Temp[i] += (heatFlux[i] + heatSource[i])*dt/denom;
+    }
+    heatFlux[i] = 0.;
+  }
+  for (int i = nlocal; i < nall; i++)
+    heatFlux[i] = 0.;
+}
+
+/* ----------------------------------------------------------------------
+   fused integrator: integrate the fluxes of the last step now, so that
+   Temp is complete at the end of a run and in restart files
+------------------------------------------------------------------------- */
+
+void FixHeatGran::flush_fluxes()
+{
+  if(INTEGRATOR_STE == integrator_ || !flux_pending_)
+    return;
+
+  updatePtrs();
+  integrate_temperature(INTEGRATOR_IMPLICIT == integrator_ && conductance_step_ == update->ntimestep);
+  flux_pending_ = false;
+}
 
-     //if (mask[i] & groupbit)
-     {
-        directionalHeatFlux[i][0] = 0.;
-        directionalHeatFlux[i][1] = 0.;
-        directionalHeatFlux[i][2] = 0.;
-     }
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGran::post_run()
+{
+  flush_fluxes();
+}
+
+/* ----------------------------------------------------------------------
+   called before the per-atom data is packed into the restart file
+   no global state is needed on restart, only the integrator is written
+------------------------------------------------------------------------- */
+
+void FixHeatGran::write_restart(FILE *fp)
+{
+  flush_fluxes();
+
+  if(comm->me == 0)
+  {
+    double integrator = static_cast<double>(integrator_);
+    int size = sizeof(double);
+    fwrite(&size,sizeof(int),1,fp);
+    fwrite(&integrator,sizeof(double),1,fp);
   }
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGran::restart(char *buf)
+{
+  UNUSED(buf);
+}
+
+/* ----------------------------------------------------------------------
+   fused integrator: ghost temperatures for this step
+------------------------------------------------------------------------- */
+
+void FixHeatGran::pre_force(int vflag)
+{
+  // ghost body tags are new after a neighbor list build
+  if(lumped_bodies_ && body_tag_build_ != neighbor->lastcall)
+    refresh_body_tags();
+
+  if(INTEGRATOR_STE != integrator_)
+    forward_temperature();
+}
 
-  //update ghosts
-  fix_directionalHeatFlux->do_forward_comm();
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGran::forward_temperature()
+{
+  fix_temp->do_forward_comm();
+}
+
+/* ----------------------------------------------------------------------
+   lumped mode with the transport equation: advance the body temperatures
+   and set the heat flux of each sphere so that the transport equation
+   moves it to the temperature of its body
+   called before the temperature is integrated by the transport equation
+------------------------------------------------------------------------- */
+
+void FixHeatGran::final_integrate()
+{
+  if(!lumped_bodies_ || INTEGRATOR_STE != integrator_) return;
+
+  updatePtrs();
+
+  double *rmass = atom->rmass;
+  int *type = atom->type;
+  int nlocal = atom->nlocal;
+  const double dt = update->dt;
+
+  integrate_body_temperatures(false);
+
+  for(int i = 0; i < nlocal; i++)
+  {
+    const int b = static_cast<int>(body_tag_[i]) - 1;
+    if(b < 0) continue;
+    heatFlux[i] = (body_temp_[b]-Temp[i])*rmass[i]*capacity_[type[i]-1]/dt - heatSource[i];
+  }
 }
 
 /* ---------------------------------------------------------------------- */
 
 double FixHeatGran::compute_scalar()
 {
-    return fix_ste->compute_scalar();
+    if(INTEGRATOR_STE == integrator_)
+      return fix_ste->compute_scalar();
+
+    // thermal energy of the group
+    double *rmass = atom->rmass;
+    int *type = atom->type;
+    int *mask = atom->mask;
+    int nlocal = atom->nlocal;
+    double energy = 0.;
+
+    updatePtrs();
+    for (int i = 0; i < nlocal; i++)
+      if(mask[i] & groupbit)
+        energy += rmass[i]*capacity_[type[i]-1]*Temp[i];
+
+    MPI_Sum_Scalar(energy,world);
+    return energy;
+}
+
+/* ----------------------------------------------------------------------
+   thermal timestep control: critical step, DEM steps spanned by one
+   thermal update and number of thermal sub-cycles per DEM step
+------------------------------------------------------------------------- */
+
+double FixHeatGran::compute_vector(int n)
+{
+    if(n == 0) return dt_thermal_crit_;
+    if(n == 1) return static_cast<double>(thermal_span_);
+    return static_cast<double>(thermal_subcycles_);
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGran::grow_conductance()
+{
+  if(nmax_conductance_ < atom->nmax)
+  {
+    nmax_conductance_ = atom->nmax;
+    memory->grow(conductance_,nmax_conductance_,"heat/gran:conductance_");
+  }
+}
+
+/* ----------------------------------------------------------------------
+   estimate the critical thermal step from the conductance sums
+   the explicit update of particle i is stable for dt < m_i c_i / G_i
+   G_i is the sum of particle and wall conductances of i
+------------------------------------------------------------------------- */
+
+void FixHeatGran::update_thermal_timestep()
+{
+  double *rmass = atom->rmass;
+  int *type = atom->type;
+  int *mask = atom->mask;
+  int nlocal = atom->nlocal;
+
+  double dt_crit = BIG_FIX_HEAT_GRAN;
+
+  for(int i = 0; i < nlocal; i++)
+  {
+    if(!(mask[i] & groupbit)) continue;
+
+    const double G = conductance_[i];
+    if(G > 0.)
+      dt_crit = std::min(dt_crit,rmass[i]*capacity_[type[i]-1]/G);
+  }
+
+  MPI_Min_Scalar(dt_crit,world);
+  dt_thermal_crit_ = dt_crit;
+
+  const double dt = update->dt;
+  const double dt_stable = thermal_safety_*dt_crit;
+
+  if(dt_stable >= dt)
+  {
+    thermal_span_ = std::min(thermal_max_span_,static_cast<int>(dt_stable/dt));
+    thermal_subcycles_ = 1;
+  }
+  else
+  {
+    thermal_span_ = 1;
+    thermal_subcycles_ = static_cast<int>(ceil(dt/dt_stable));
+    if(thermal_subcycles_ > 100 && !subcycle_warned_ && comm->me == 0)
+    {
+      subcycle_warned_ = true;
+      error->warning(FLERR,"Fix heat/gran: more than 100 thermal sub-cycles per time-step, consider reducing the time-step");
+    }
+  }
 }
 
 /* ---------------------------------------------------------------------- */
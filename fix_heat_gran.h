@@ -45,6 +45,7 @@
 #include "fix.h"
 
 static const double SMALL_FIX_HEAT_GRAN = 1.e-6;
+static const double BIG_FIX_HEAT_GRAN = 1.e20;
 
 namespace LAMMPS_NS {
 
@@ -55,13 +56,20 @@ namespace LAMMPS_NS {
 
   public:
     FixHeatGran(class LAMMPS *, int, char **);
-    ~FixHeatGran(){};
+    ~FixHeatGran();
     virtual void post_create();
     virtual void pre_delete(bool unfixflag){ UNUSED(unfixflag); };
 
     void initial_integrate(int vflag);
+    void final_integrate();
+    virtual void pre_force(int vflag);
+    virtual void post_run();
+
+    virtual void write_restart(FILE *);
+    virtual void restart(char *);
 
     virtual double compute_scalar();
+    virtual double compute_vector(int);
     virtual int setmask();
     virtual void init();
 
@@ -71,6 +79,10 @@ namespace LAMMPS_NS {
     virtual void unregister_compute_pair_local(class ComputePairGranLocal *);
     virtual void updatePtrs();
 
+    // contact recording, implemented in FixHeatGranCond
+    virtual bool records_contacts() const { return false; }
+    virtual void record_wall_contact(int,int,double,double,double) {}
+
   protected:
     class ComputePairGranLocal *cpl;
     class FixPropertyAtom* fix_heatFlux;
@@ -85,8 +97,83 @@ namespace LAMMPS_NS {
     double T0;          
     double **directionalHeatFlux;
 
+    // directional heat flux is only allocated, computed and communicated
+    // on demand: via 'store_directional_flux yes' or if directionalHeatFlux
+    // is defined by another command
+    // backward compatibility: it used to be always on, input scripts that
+    // dump or compute f_directionalHeatFlux now need 'store_directional_flux yes'
+    bool directional_flux_;
+
+    // lumped mode: each rigid body is a single thermal node, its
+    // temperature is integrated from the heat rate of all its spheres
+    // bodies are identified by the per-atom tag lumpedBody (body index + 1),
+    // which is communicated to ghosts, so owned and ghost atoms use one rule
+    bool lumped_bodies_;
+    class FixRigid *fix_rigid_;
+    class FixPropertyAtom *fix_body_tag_;
+    double *body_tag_;
+    bigint body_tag_build_;
+    double *capacity_;
+    double *body_temp_, *body_cap_;
+    double *body_sum_local_, *body_sum_;
+    int nbody_;
+    void set_body_tags();
+    void refresh_body_tags();
+    void lump_body_temperatures();
+    void integrate_body_temperatures(bool);
+
+    // body temperatures are only kept on the ranks that own spheres of
+    // the body; per step only bodies split across ranks are reduced
+    // body_owner_ is the rank that holds the valid temperature of a body,
+    // ranks that receive a body by migration take it from there
+    int *body_owner_, *body_rank_;
+    int *body_split_, *body_local_;
+    int nbody_split_, nbody_local_;
+    double *body_split_sum_;
+    bigint body_split_build_;
+    void update_body_partition();
+
+    // true if i and j are spheres of the same rigid body
+    inline bool same_body(int i, int j)
+    { return body_tag_[i] > 0. && body_tag_[i] == body_tag_[j]; }
+
     class PairGran *pair_gran;
     int history_flag;
+
+    // contacts are replayed from a log, no granular pair style needed
+    bool replay_;
+
+    // temperature integration, either by fix transportequation/scalar or
+    // fused into initial_integrate() of this fix
+    enum { INTEGRATOR_STE, INTEGRATOR_EXPLICIT, INTEGRATOR_IMPLICIT };
+    int integrator_;
+
+    // fused integrator: fluxes accumulated since the last initial_integrate()
+    // are not yet in Temp, they are flushed at the end of a run and
+    // before a restart file is written
+    bool flux_pending_;
+    void integrate_temperature(bool);
+    void flush_fluxes();
+
+    // thermal timestep control
+    // the critical step follows from the per-particle conductance sums,
+    // particle heat transfer either spans several steps or is sub-cycled
+    bool thermal_control_;
+    double thermal_safety_;
+    int thermal_max_span_;
+    double dt_thermal_crit_;
+    int thermal_span_, thermal_subcycles_;
+    bigint last_thermal_step_;
+    bool subcycle_warned_;
+    bool accumulate_conductance_;
+    double *conductance_;
+    int nmax_conductance_;
+    bigint conductance_step_;
+    void grow_conductance();
+    void update_thermal_timestep();
+
+    // fused integrator: ghost temperatures of this step
+    virtual void forward_temperature();
   };
 
 }
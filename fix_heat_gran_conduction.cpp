@@ -42,18 +42,42 @@
 #include "fix_heat_gran_conduction.h"
 
 #include "atom.h"
+#include "comm.h"
 #include "compute_pair_gran_local.h"
+#include "domain.h"
 #include "fix_property_atom.h"
 #include "fix_property_global.h"
+#include "fix_wall_gran.h"
 #include "force.h"
 #include "math_extra.h"
 #include "properties.h"
 #include "modify.h"
 #include "neigh_list.h"
+#include "neighbor.h"
 #include "pair_gran.h"
+#include "memory.h"
+#include "output.h"
+#include "update.h"
+#include "mpi_liggghts.h"
 #include <cmath>
 #include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// explicit SIMD kernels for the batched conduction evaluation,
+// the instruction set is selected at runtime
+#if defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5) && (defined(__x86_64__) || defined(__i386__))
+#define FIX_HEAT_GRAN_BATCH_SIMD
+#include <immintrin.h>
+#endif
+
 #define STEFAN_BOLTZMANN 5.67e-8
+#define DELTA_FLUX_CACHE 10000
+#define DELTA_NETWORK 10000
+#define DELTA_RECORD 10000
+#define DELTA_SUBLIST 10000
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -65,6 +89,30 @@ enum{ CONDUCTION_CONTACT_AREA_OVERLAP,
       CONDUCTION_CONTACT_AREA_CONSTANT,
       CONDUCTION_CONTACT_AREA_PROJECTION};
 
+// contacts evaluated in one pass of the conduction loop
+
+enum{ CONTACTS_ALL,
+      CONTACTS_GHOST,
+      CONTACTS_OWNED};
+
+// message tags of the ghost plan
+
+enum{ GHOST_PLAN_TAG = 7801,
+      GHOST_FLUX_TAG = 7802,
+      GHOST_TEMP_TAG = 7803};
+
+// contact log for record_contacts / replay_contacts
+// file starts with the magic, followed by frames of
+// header, atom, pair and wall records, see FixHeatGranCond::Record*
+
+static const char CONTACT_LOG_MAGIC[8] = {'L','G','C','N','T','L','O','G'};
+
+struct ContactLogFrame
+{
+  bigint step;
+  bigint natoms, npairs, nwalls;
+};
+
 /* ---------------------------------------------------------------------- */
 
 FixHeatGranCond::FixHeatGranCond(class LAMMPS *lmp, int narg, char **arg) :
@@ -82,9 +130,127 @@ FixHeatGranCond::FixHeatGranCond(class LAMMPS *lmp, int narg, char **arg) :
   wall_temp_(0),
   area_calculation_mode_(CONDUCTION_CONTACT_AREA_OVERLAP),
   fixed_contact_area_(0.),
+  cg_(1.),
+  cg_contact_area_(0.),
+  cg_view_factor_(1.),
   area_correction_flag_(0),
-  deltan_ratio_(0)
+  deltan_ratio_(0),
+  equilibrium_tolerance_(0.),
+  full_sweep_every_(10),
+  cull_track_(false),
+  culled_heat_(0.),
+  total_heat_(0.),
+  culling_warned_(false),
+  cull_clock_(0.),
+  cull_build_(-1),
+  maxcull_i_(0),
+  maxcull_(0),
+  cull_first_(0),
+  cull_stamp_(0),
+  cache_contact_flux_(false),
+  fill_flux_cache_(false),
+  flux_cache_step_(-1),
+  ncache_(0),
+  maxcache_(0),
+  cache_i_(0),
+  cache_j_(0),
+  cache_flux_(0),
+  split_phase_(false),
+  comm_owner_(false),
+  ghost_plan_build_(-1),
+  nmax_ghost_plan_(0),
+  ghost_owner_(0),
+  ghost_index_(0),
+  temp_comm_compress_(false),
+  temp_comm_tol_(0.),
+  temp_comm_refresh_(0),
+  last_temp_refresh_(-1),
+  steady_every_(0),
+  steady_tolerance_(1.e-8),
+  steady_max_iter_(1000),
+  assemble_network_(false),
+  nnet_(0),
+  maxnet_(0),
+  net_i_(0),
+  net_j_(0),
+  net_hc_(0),
+  fix_wall_conductance_(0),
+  fix_wall_conductance_temp_(0),
+  nmax_steady_(0),
+  diag_(0),
+  rhs_(0),
+  sol_(0),
+  res_(0),
+  zvec_(0),
+  dir_(0),
+  aprod_(0),
+  comm_nvec_(0),
+  record_file_(0),
+  record_every_(0),
+  record_frame_(false),
+  record_fp_(0),
+  nrec_pair_(0),
+  maxrec_pair_(0),
+  nrec_wall_(0),
+  maxrec_wall_(0),
+  maxrec_atom_(0),
+  rec_atom_(0),
+  rec_pair_(0),
+  rec_wall_(0),
+  maxrec_recv_(0),
+  rec_recv_(0),
+  replay_file_(0),
+  replay_map_(0),
+  replay_size_(0),
+  replay_frame_(-1),
+  replay_applied_frame_(-1),
+  replay_missing_(0),
+  replay_walls_(true),
+  replay_wall_check_(true),
+  span_weight_(1.),
+  thermal_eval_step_(false),
+  subcycle_pending_(false),
+  nmax_subcycle_(0),
+  sub_temp_(0),
+  sub_flux_(0),
+  sub_flux_avg_(0),
+  packed_state_(false),
+  comm_state_(false),
+  state_build_(-1),
+  nmax_thermal_state_(0),
+  thermal_state_mem_(0),
+  thermal_state_(0),
+  group_sublist_(false),
+  sublist_build_(-1),
+  nsub_i_(0),
+  maxsub_i_(0),
+  maxsub_j_(0),
+  sub_ii_(0),
+  sub_first_(0),
+  sub_jj_(0)
 {
+  comm_vec_[0] = comm_vec_[1] = 0;
+
+  nbatch_ = 0;
+  batch_simd_ = select_batch_kernel();
+  memory->create(batch_i_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_i_");
+  memory->create(batch_j_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_j_");
+  memory->create(batch_delx_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_delx_");
+  memory->create(batch_dely_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_dely_");
+  memory->create(batch_delz_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_delz_");
+  memory->create(batch_rsq_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_rsq_");
+  memory->create(batch_radi_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_radi_");
+  memory->create(batch_radj_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_radj_");
+  memory->create(batch_Ti_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_Ti_");
+  memory->create(batch_Tj_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_Tj_");
+  memory->create(batch_tcoi_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_tcoi_");
+  memory->create(batch_tcoj_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_tcoj_");
+  memory->create(batch_ratio_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_ratio_");
+  memory->create(batch_area_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_area_");
+  memory->create(batch_hc_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_hc_");
+  memory->create(batch_flux_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_flux_");
+  memory->create(batch_weight_,CONDUCTION_BATCH_SIZE,"heat/gran/conduction:batch_weight_");
+
   iarg_ = 5;
 
   bool hasargs = true;
@@ -128,12 +294,177 @@ FixHeatGranCond::FixHeatGranCond(class LAMMPS *lmp, int narg, char **arg) :
       else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after 'store_contact_data'");
       iarg_ += 2;
       hasargs = true;
+    } else if(strcmp(arg[iarg_],"store_directional_flux") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'store_directional_flux'");
+      if(strcmp(arg[iarg_+1],"yes") == 0)
+        directional_flux_ = true;
+      else if(strcmp(arg[iarg_+1],"no") == 0)
+        directional_flux_ = false;
+      else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after 'store_directional_flux'");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"equilibrium_tolerance") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'equilibrium_tolerance'");
+      equilibrium_tolerance_ = force->numeric(FLERR,arg[iarg_+1]);
+      if(equilibrium_tolerance_ < 0.)
+        error->fix_error(FLERR,this,"'equilibrium_tolerance' must be >= 0");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"full_sweep_every") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'full_sweep_every'");
+      full_sweep_every_ = force->inumeric(FLERR,arg[iarg_+1]);
+      if(full_sweep_every_ < 1)
+        error->fix_error(FLERR,this,"'full_sweep_every' must be > 0");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"cache_contact_flux") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'cache_contact_flux'");
+      if(strcmp(arg[iarg_+1],"yes") == 0)
+        cache_contact_flux_ = true;
+      else if(strcmp(arg[iarg_+1],"no") == 0)
+        cache_contact_flux_ = false;
+      else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after 'cache_contact_flux'");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"lumped_bodies") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'lumped_bodies'");
+      if(strcmp(arg[iarg_+1],"yes") == 0)
+        lumped_bodies_ = true;
+      else if(strcmp(arg[iarg_+1],"no") == 0)
+        lumped_bodies_ = false;
+      else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after 'lumped_bodies'");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"coarsegraining") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'coarsegraining'");
+      cg_ = force->numeric(FLERR,arg[iarg_+1]);
+      if(cg_ < 1.)
+        error->fix_error(FLERR,this,"'coarsegraining' ratio must be >= 1");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"split_phase") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'split_phase'");
+      if(strcmp(arg[iarg_+1],"yes") == 0)
+        split_phase_ = true;
+      else if(strcmp(arg[iarg_+1],"no") == 0)
+        split_phase_ = false;
+      else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after 'split_phase'");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"temp_comm_tolerance") == 0) {
+      if (iarg_+3 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'temp_comm_tolerance'");
+      temp_comm_compress_ = true;
+      temp_comm_tol_ = force->numeric(FLERR,arg[iarg_+1]);
+      temp_comm_refresh_ = force->inumeric(FLERR,arg[iarg_+2]);
+      if(temp_comm_tol_ < 0.)
+        error->fix_error(FLERR,this,"'temp_comm_tolerance' tolerance must be >= 0");
+      if(temp_comm_refresh_ < 1)
+        error->fix_error(FLERR,this,"'temp_comm_tolerance' refresh interval must be > 0");
+      iarg_ += 3;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"steady_state") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'steady_state'");
+      steady_every_ = force->inumeric(FLERR,arg[iarg_+1]);
+      if(steady_every_ < 0)
+        error->fix_error(FLERR,this,"'steady_state' must be >= 0");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"steady_tolerance") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'steady_tolerance'");
+      steady_tolerance_ = force->numeric(FLERR,arg[iarg_+1]);
+      if(steady_tolerance_ <= 0.)
+        error->fix_error(FLERR,this,"'steady_tolerance' must be > 0");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"steady_max_iter") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'steady_max_iter'");
+      steady_max_iter_ = force->inumeric(FLERR,arg[iarg_+1]);
+      if(steady_max_iter_ < 1)
+        error->fix_error(FLERR,this,"'steady_max_iter' must be > 0");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"record_contacts") == 0) {
+      if (iarg_+3 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'record_contacts'");
+      delete []record_file_;
+      record_file_ = new char[strlen(arg[iarg_+1])+1];
+      strcpy(record_file_,arg[iarg_+1]);
+      record_every_ = force->inumeric(FLERR,arg[iarg_+2]);
+      if(record_every_ < 1)
+        error->fix_error(FLERR,this,"'record_contacts' interval must be > 0");
+      iarg_ += 3;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"replay_contacts") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'replay_contacts'");
+      delete []replay_file_;
+      replay_file_ = new char[strlen(arg[iarg_+1])+1];
+      strcpy(replay_file_,arg[iarg_+1]);
+      replay_ = true;
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"packed_state") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'packed_state'");
+      if(strcmp(arg[iarg_+1],"yes") == 0)
+        packed_state_ = true;
+      else if(strcmp(arg[iarg_+1],"no") == 0)
+        packed_state_ = false;
+      else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after 'packed_state'");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"integrator") == 0) {
+      if (iarg_+2 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'integrator'");
+      if(strcmp(arg[iarg_+1],"ste") == 0)
+        integrator_ = INTEGRATOR_STE;
+      else if(strcmp(arg[iarg_+1],"explicit") == 0)
+        integrator_ = INTEGRATOR_EXPLICIT;
+      else if(strcmp(arg[iarg_+1],"implicit") == 0)
+        integrator_ = INTEGRATOR_IMPLICIT;
+      else error->fix_error(FLERR,this,"expecting 'ste', 'explicit' or 'implicit' after 'integrator'");
+      iarg_ += 2;
+      hasargs = true;
+    } else if(strcmp(arg[iarg_],"thermal_timestep_control") == 0) {
+      if (iarg_+3 > narg) error->fix_error(FLERR,this,"not enough arguments for keyword 'thermal_timestep_control'");
+      thermal_control_ = true;
+      thermal_safety_ = force->numeric(FLERR,arg[iarg_+1]);
+      thermal_max_span_ = force->inumeric(FLERR,arg[iarg_+2]);
+      if(thermal_safety_ <= 0. || thermal_safety_ > 1.)
+        error->fix_error(FLERR,this,"'thermal_timestep_control' safety factor must be > 0 and <= 1");
+      if(thermal_max_span_ < 1)
+        error->fix_error(FLERR,this,"'thermal_timestep_control' maximum span must be > 0");
+      iarg_ += 3;
+      hasargs = true;
     } else if(strcmp(style,"heat/gran/conduction") == 0)
         error->fix_error(FLERR,this,"unknown keyword");
   }
 
   if(CONDUCTION_CONTACT_AREA_OVERLAP != area_calculation_mode_ && 1 == area_correction_flag_)
     error->fix_error(FLERR,this,"can use 'area_correction' only for 'contact_area = overlap'");
+
+  if(steady_every_ > 0 && lumped_bodies_)
+    error->fix_error(FLERR,this,"can not use 'steady_state' together with 'lumped_bodies'");
+
+  if(replay_ && (record_every_ > 0 || steady_every_ > 0))
+    error->fix_error(FLERR,this,"can not use 'replay_contacts' together with 'record_contacts' or 'steady_state'");
+  if(replay_ && area_correction_flag_)
+    error->fix_error(FLERR,this,"can not use 'replay_contacts' together with 'area_correction'");
+  if(replay_ && thermal_control_)
+    error->fix_error(FLERR,this,"can not use 'replay_contacts' together with 'thermal_timestep_control'");
+  if(temp_comm_compress_ && INTEGRATOR_STE == integrator_)
+    error->fix_error(FLERR,this,"'temp_comm_tolerance' requires 'integrator explicit' or 'integrator implicit'");
+  if(temp_comm_compress_ && packed_state_)
+    error->fix_error(FLERR,this,"can not use 'temp_comm_tolerance' together with 'packed_state', "
+                                "which communicates the ghost temperatures with the positions");
+  if(INTEGRATOR_IMPLICIT == integrator_ && (thermal_control_ || replay_))
+    error->fix_error(FLERR,this,"can not use 'integrator implicit' together with 'thermal_timestep_control' or 'replay_contacts'");
+
+  accumulate_conductance_ = thermal_control_ || INTEGRATOR_IMPLICIT == integrator_;
+
+  // critical thermal step, span and sub-cycles as thermo output
+  if(thermal_control_)
+  {
+    vector_flag = 1;
+    size_vector = 3;
+    extvector = 0;
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -143,6 +474,65 @@ FixHeatGranCond::~FixHeatGranCond()
 
   if (conductivity_)
     delete []conductivity_;
+
+  memory->destroy(cull_first_);
+  memory->destroy(cull_stamp_);
+
+  memory->destroy(cache_i_);
+  memory->destroy(cache_j_);
+  memory->destroy(cache_flux_);
+
+  memory->destroy(net_i_);
+  memory->destroy(net_j_);
+  memory->destroy(net_hc_);
+  memory->destroy(diag_);
+  memory->destroy(rhs_);
+  memory->destroy(sol_);
+  memory->destroy(res_);
+  memory->destroy(zvec_);
+  memory->destroy(dir_);
+  memory->destroy(aprod_);
+
+  if(record_fp_) fclose(record_fp_);
+  delete []record_file_;
+  memory->destroy(rec_atom_);
+  memory->destroy(rec_pair_);
+  memory->destroy(rec_wall_);
+  memory->sfree(rec_recv_);
+
+  if(replay_map_) munmap(replay_map_,replay_size_);
+  delete []replay_file_;
+
+  memory->destroy(sub_temp_);
+  memory->destroy(sub_flux_);
+  memory->destroy(sub_flux_avg_);
+
+  memory->sfree(thermal_state_mem_);
+
+  memory->destroy(sub_ii_);
+  memory->destroy(sub_first_);
+  memory->destroy(sub_jj_);
+
+  memory->destroy(batch_i_);
+  memory->destroy(batch_j_);
+  memory->destroy(batch_delx_);
+  memory->destroy(batch_dely_);
+  memory->destroy(batch_delz_);
+  memory->destroy(batch_rsq_);
+  memory->destroy(batch_radi_);
+  memory->destroy(batch_radj_);
+  memory->destroy(batch_Ti_);
+  memory->destroy(batch_Tj_);
+  memory->destroy(batch_tcoi_);
+  memory->destroy(batch_tcoj_);
+  memory->destroy(batch_ratio_);
+  memory->destroy(batch_area_);
+  memory->destroy(batch_hc_);
+  memory->destroy(batch_flux_);
+  memory->destroy(batch_weight_);
+
+  memory->destroy(ghost_owner_);
+  memory->destroy(ghost_index_);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -218,6 +608,42 @@ void FixHeatGranCond::post_create()
 
   if(store_contact_data_ && (!fix_conduction_contact_area_ || !fix_n_conduction_contacts_ || !fix_wall_heattransfer_coeff_ || !fix_wall_temperature_))
     error->one(FLERR,"internal error");
+
+  // register wall conductance storage for steady-state mode and
+  // thermal timestep control
+  // sum of wall conductances and of conductance times wall temperature,
+  // accumulated by fix wall/gran
+  fix_wall_conductance_ = static_cast<FixPropertyAtom*>(modify->find_fix_property("wallConductance","property/atom","scalar",0,0,this->style,false));
+  if(!fix_wall_conductance_ && (steady_every_ > 0 || accumulate_conductance_))
+  {
+    const char* fixarg[10];
+    fixarg[0]="wallConductance";
+    fixarg[1]="all";
+    fixarg[2]="property/atom";
+    fixarg[3]="wallConductance";
+    fixarg[4]="scalar";
+    fixarg[5]="no";
+    fixarg[6]="no";
+    fixarg[7]="no";
+    fixarg[8]="0.";
+    fix_wall_conductance_ = modify->add_fix_property_atom(9,const_cast<char**>(fixarg),style);
+  }
+
+  fix_wall_conductance_temp_ = static_cast<FixPropertyAtom*>(modify->find_fix_property("wallConductanceTemp","property/atom","scalar",0,0,this->style,false));
+  if(!fix_wall_conductance_temp_ && (steady_every_ > 0 || accumulate_conductance_))
+  {
+    const char* fixarg[10];
+    fixarg[0]="wallConductanceTemp";
+    fixarg[1]="all";
+    fixarg[2]="property/atom";
+    fixarg[3]="wallConductanceTemp";
+    fixarg[4]="scalar";
+    fixarg[5]="no";
+    fixarg[6]="no";
+    fixarg[7]="no";
+    fixarg[8]="0.";
+    fix_wall_conductance_temp_ = modify->add_fix_property_atom(9,const_cast<char**>(fixarg),style);
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -237,6 +663,8 @@ int FixHeatGranCond::setmask()
   int mask = FixHeatGran::setmask();
   mask |= PRE_FORCE;
   mask |= POST_FORCE;
+  if(steady_every_ > 0 || record_every_ > 0 || accumulate_conductance_) mask |= END_OF_STEP;
+  if(thermal_control_) mask |= FINAL_INTEGRATE;
   return mask;
 }
 
@@ -341,26 +769,114 @@ void FixHeatGranCond::init()
 
   updatePtrs();
 
+  // size of packed reverse communication
+  // heatFlux and optionally directionalHeatFlux, contact area and number of contacts
+  // and conductance sum
+  comm_reverse = flux_comm_size();
+
+  // steady-state solver communicates up to two vectors,
+  // sub-cycling communicates the scratch temperature
+  if(steady_every_ > 0)
+    comm_reverse = std::max(comm_reverse,2);
+  if(steady_every_ > 0 || thermal_control_)
+    comm_forward = 1;
+
+  // packed state communicates position and temperature of ghosts
+  if(packed_state_)
+    comm_forward = 4;
+  state_build_ = -1;
+
+  // ghost plan sends owner rank and index of each atom
+  if(split_phase_ || temp_comm_compress_)
+    comm_forward = std::max(comm_forward,2);
+  ghost_plan_build_ = -1;
+  last_temp_refresh_ = -1;
+
+  // cached fluxes are not valid across runs
+  flux_cache_step_ = -1;
+
+  // culling stamps refer to the neighbor list of the last run
+  cull_build_ = -1;
+  cull_clock_ = 0.;
+
+  // group sublist is only worth it if the group is not all,
+  // it is rebuilt in the first evaluation of a run
+  group_sublist_ = igroup != 0;
+  sublist_build_ = -1;
+
+  // coarsegraining
+  // a coarse-grained particle of ratio cg represents cg^3 original particles;
+  // the interface between two coarse particles represents cg^2 original contacts
+  // in parallel and cg layers in series, so its conductance must be cg times the
+  // one of an original contact
+  // overlap and projection areas scale with cg^2 by geometric similarity, which
+  // yields this scaling automatically; a constant area is given per original
+  // contact and is scaled by cg^2
+  // radiative exchange of a coarse pair scales with its surface (cg^2) instead
+  // of cg, so the view factor is scaled by 1/cg
+
+  cg_contact_area_ = cg_*cg_*fixed_contact_area_;
+  cg_view_factor_ = 1./cg_;
+
   // error checks on coarsegraining
-  
+  if(cg_ > 1. && modify->n_fixes_style("wall/gran") > 0 && comm->me == 0)
+    error->warning(FLERR,"Fix heat/gran/conduction: 'coarsegraining' is not applied to heat transfer with walls");
+
+  // contact log is opened once and appended to across runs
+  if(record_every_ > 0 && !record_fp_ && comm->me == 0)
+  {
+    record_fp_ = fopen(record_file_,"wb");
+    if(!record_fp_)
+      error->one(FLERR,"Fix heat/gran/conduction: cannot open file for 'record_contacts'");
+    fwrite(CONTACT_LOG_MAGIC,sizeof(char),8,record_fp_);
+  }
+
+  if(replay_)
+  {
+    if(atom->map_style == 0)
+      error->fix_error(FLERR,this,"'replay_contacts' requires an atom map, see atom_modify");
+    if(!replay_map_)
+      open_replay();
+    replay_frame_ = replay_applied_frame_ = -1;
+    replay_missing_ = 0;
+    replay_wall_check_ = true;
+  }
 }
 
 /* ---------------------------------------------------------------------- */
 
 void FixHeatGranCond::pre_force(int vflag)
 {
-    
+    FixHeatGran::pre_force(vflag);
+
     if(store_contact_data_)
     {
         fix_wall_heattransfer_coeff_->set_all(0.);
         fix_wall_temperature_->set_all(0.);
     }
+
+    if(fix_wall_conductance_)
+    {
+        fix_wall_conductance_->set_all(0.);
+        fix_wall_conductance_temp_->set_all(0.);
+    }
+
+    // contacts of this step are recorded by post_force()
+    // and by fix wall/gran, the frame is written in end_of_step()
+    record_frame_ = record_every_ > 0 && 0 == update->ntimestep % record_every_;
+    if(record_frame_)
+      nrec_pair_ = nrec_wall_ = 0;
 }
 
 /* ---------------------------------------------------------------------- */
 
 void FixHeatGranCond::post_force(int vflag)
 {
+  if(replay_)
+  {
+    replay_eval();
+    return;
+  }
 
   if(history_flag == 0 && CONDUCTION_CONTACT_AREA_OVERLAP == area_calculation_mode_)
     post_force_eval<0,CONDUCTION_CONTACT_AREA_OVERLAP>(vflag,0);
@@ -384,6 +900,14 @@ void FixHeatGranCond::cpl_evaluate(ComputePairGranLocal *caller)
 {
   if(caller != cpl) error->all(FLERR,"Illegal situation in FixHeatGranCond::cpl_evaluate");
 
+  // fluxes of this step were cached during post_force
+  if(flux_cache_step_ == update->ntimestep)
+  {
+    for(int k = 0; k < ncache_; k++)
+      cpl->add_heat(cache_i_[k],cache_j_[k],cache_flux_[k]);
+    return;
+  }
+
   if(history_flag == 0 && CONDUCTION_CONTACT_AREA_OVERLAP == area_calculation_mode_)
     post_force_eval<0,CONDUCTION_CONTACT_AREA_OVERLAP>(0,1);
   if(history_flag == 1 && CONDUCTION_CONTACT_AREA_OVERLAP == area_calculation_mode_)
@@ -405,34 +929,67 @@ void FixHeatGranCond::cpl_evaluate(ComputePairGranLocal *caller)
 template <int HISTFLAG,int CONTACTAREA>
 void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
 {
-  double hc,contactArea,delta_n,flux,flux2,dirFlux[3],dirFlux2[3];
-  int i,j,ii,jj,inum,jnum;
-  double xtmp,ytmp,ztmp,delx,dely,delz;
-  double radi,radj,radsum,rsq,r,tcoi,tcoj;
-  int *ilist,*jlist,*numneigh,**firstneigh;
-  int *contact_flag,**first_contact_flag;
-
   int newton_pair = force->newton_pair;
-
-  double disless,ViewFactor;
+  int nlocal = atom->nlocal;
 
   if (strcmp(force->pair_style,"hybrid")==0)
     error->warning(FLERR,"Fix heat/gran/conduction implementation may not be valid for pair style hybrid");
   if (strcmp(force->pair_style,"hybrid/overlay")==0)
     error->warning(FLERR,"Fix heat/gran/conduction implementation may not be valid for pair style hybrid/overlay");
 
-  inum = pair_gran->list->inum;
-  ilist = pair_gran->list->ilist;
-  numneigh = pair_gran->list->numneigh;
-  firstneigh = pair_gran->list->firstneigh;
-  if(HISTFLAG) first_contact_flag = pair_gran->listgranhistory->firstneigh;
+  // on steady-state steps, the complete conductance network is assembled
+  assemble_network_ = steady_every_ > 0 && !cpl_flag && 0 == update->ntimestep % steady_every_;
+  if(assemble_network_) nnet_ = 0;
+
+  // thermal timestep control
+  // particle heat transfer is evaluated every thermal_span_ steps with fluxes
+  // weighted by the number of steps since the last evaluation, or sub-cycled
+  span_weight_ = 1.;
+  const bool control = thermal_control_ && !cpl_flag;
+  const bool subcycle = control && thermal_subcycles_ > 1;
+  if(control)
+  {
+    if(last_thermal_step_ >= 0 && update->ntimestep - last_thermal_step_ < thermal_span_ && !assemble_network_ && !record_frame_)
+    {
+      thermal_eval_step_ = false;
+      flux_cache_step_ = -1;
+      return;
+    }
+    if(last_thermal_step_ >= 0)
+      span_weight_ = static_cast<double>(update->ntimestep - last_thermal_step_);
+    last_thermal_step_ = update->ntimestep;
+    thermal_eval_step_ = true;
+  }
 
-  double *radius = atom->radius;
-  double **x = atom->x;
-  int *type = atom->type;
-  int nlocal = atom->nlocal;
-  int *mask = atom->mask;
+  // per-particle conductance sums for timestep control and implicit integration
+  if(accumulate_conductance_ && !cpl_flag)
+  {
+    grow_conductance();
+    const int nall = atom->nlocal + atom->nghost;
+    for(int i = 0; i < nall; i++)
+      conductance_[i] = 0.;
+    conductance_step_ = update->ntimestep;
+  }
 
+  // contacts close to thermal equilibrium are culled except on full sweep steps
+  // a contact is applied with the weight of the steps since it was last applied,
+  // so skipped steps are made up exactly and nothing else is weighted up
+  cull_track_ = equilibrium_tolerance_ > 0. && !cpl_flag && !subcycle;
+  cull_contacts_ = cull_track_ && !assemble_network_ && !record_frame_;
+  full_sweep_ = !cull_contacts_ || 0 == update->ntimestep % full_sweep_every_;
+  culled_heat_ = total_heat_ = 0.;
+  if(cull_track_) cull_clock_ += span_weight_;
+
+  // on output steps, store per-contact fluxes so that
+  // cpl_evaluate() does not need to re-evaluate them
+  fill_flux_cache_ = cache_contact_flux_ && cpl && !cpl_flag && update->ntimestep == output->next;
+  if(fill_flux_cache_)
+  {
+    ncache_ = 0;
+    flux_cache_step_ = update->ntimestep;
+  }
+  else if(!cpl_flag)
+    flux_cache_step_ = -1;
 
   updatePtrs();
 
@@ -442,6 +999,68 @@ void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
     fix_n_conduction_contacts_->set_all(0.);
   }
 
+  // when sub-cycling, the fluxes of the first sub-step go to scratch storage
+  if(subcycle)
+  {
+    grow_subcycle();
+    const int nall = atom->nlocal + atom->nghost;
+    for(int i = 0; i < nall; i++)
+      sub_flux_[i] = 0.;
+    heatFlux = sub_flux_;
+  }
+
+  if(split_phase_ && newton_pair && !cpl_flag)
+    split_phase_contacts<HISTFLAG,CONTACTAREA>(cpl_flag);
+  else
+  {
+    radiation_eval(cpl_flag);
+
+    conduction_contacts<HISTFLAG,CONTACTAREA>(cpl_flag,CONTACTS_ALL);
+
+   //printf("time_conduction \n");
+    // send ghost contributions of all thermal fields in one message round
+    // nothing was added to ghosts in cpl mode, so no need to communicate
+    if(newton_pair && !cpl_flag)
+      comm->reverse_comm_fix(this);
+  }
+
+  if(cull_contacts_ && full_sweep_)
+    check_equilibrium_culling();
+
+  // remaining sub-steps follow in final_integrate(), once fix wall/gran
+  // has added the wall conductances of this step
+  if(subcycle)
+  {
+    heatFlux = fix_heatFlux->vector_atom;
+    subcycle_pending_ = true;
+  }
+
+  if(!cpl_flag && store_contact_data_)
+  for(int i = 0; i < nlocal; i++)
+  {
+     if(n_conduction_contacts_[i] > 0.5)
+        conduction_contact_area_[i] /= n_conduction_contacts_[i];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   particle-particle radiation between owned particles
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::radiation_eval(int cpl_flag)
+{
+  double flux2,dirFlux2[3];
+  int i,j;
+  double xtmp,ytmp,ztmp,delx,dely,delz;
+  double radi,radj,radsum,rsq,r;
+  double disless,ViewFactor;
+
+  int newton_pair = force->newton_pair;
+
+  double *radius = atom->radius;
+  double **x = atom->x;
+  int nlocal = atom->nlocal;
+
   //FixWallGran *fwg22222223;
   //double xplane = fwg22222223->getWallLocation();
   //printf("Xplane: %.4f \n");
@@ -460,6 +1079,7 @@ void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
     
 
     for (j = i + 1;j<nlocal;j++){
+      if (lumped_bodies_ && same_body(i,j)) continue;
       if (j != i)
       {
           delx = xtmp - x[j][0];
@@ -471,7 +1091,7 @@ void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
 
         r = sqrt(rsq);
         disless = sqrt(rsq)/(2.*radj);
-        ViewFactor = -5.2e-5+0.064/(disless*disless);
+        ViewFactor = (-5.2e-5+0.064/(disless*disless))*cg_view_factor_;
         //printf("ViewFactor:# %.4f\n",ViewFactor);
         //ViewFactor = 1./(nlocal-1);
 
@@ -485,18 +1105,21 @@ void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
         flux2 = STEFAN_BOLTZMANN*ViewFactor*(tempj-tempi)*A_sphere;
         
         //if (flux2 != 0) printf("radiation::flux::# %.4f\n",flux2);
-        
-        dirFlux2[0] = flux2*delx;
-        dirFlux2[1] = flux2*dely;
-        dirFlux2[2] = flux2*delz;
 
         if(!cpl_flag)
         {
+          const double fluxw = flux2*span_weight_;
         
-          heatFlux[i] += flux2;
-          directionalHeatFlux[i][0] += 0.50 * dirFlux2[0];
-          directionalHeatFlux[i][1] += 0.50 * dirFlux2[1];
-          directionalHeatFlux[i][2] += 0.50 * dirFlux2[2];
+          heatFlux[i] += fluxw;
+          if(directional_flux_)
+          {
+            dirFlux2[0] = fluxw*delx;
+            dirFlux2[1] = fluxw*dely;
+            dirFlux2[2] = fluxw*delz;
+            directionalHeatFlux[i][0] += 0.50 * dirFlux2[0];
+            directionalHeatFlux[i][1] += 0.50 * dirFlux2[1];
+            directionalHeatFlux[i][2] += 0.50 * dirFlux2[2];
+          }
 
           //if (heatFlux[i] != 0) printf("radiation::heatFlux::# %.4f\n",heatFlux[i]);
           
@@ -504,16 +1127,20 @@ void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
 
           if (newton_pair || j < nlocal)
           {
-            heatFlux[j] -= flux2;
-            directionalHeatFlux[j][0] += 0.50 * dirFlux2[0];
-            directionalHeatFlux[j][1] += 0.50 * dirFlux2[1];
-            directionalHeatFlux[j][2] += 0.50 * dirFlux2[2];
+            heatFlux[j] -= fluxw;
+            if(directional_flux_)
+            {
+              directionalHeatFlux[j][0] += 0.50 * dirFlux2[0];
+              directionalHeatFlux[j][1] += 0.50 * dirFlux2[1];
+              directionalHeatFlux[j][2] += 0.50 * dirFlux2[2];
+            }
           }
           
   
         }
 
         if (cpl_flag && cpl) cpl->add_heat(i,j,flux2);
+        if (fill_flux_cache_) add_to_flux_cache(i,j,flux2);
         //printf("radiation::flux::# %.4f\n",heatFlux[i]);
       
       }
@@ -522,9 +1149,72 @@ void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
     //if (heatFlux[i] != 0) printf("radiation::heatFlux::# %.4f\n",heatFlux[25]);
   }
   //printf("radiation::heatFlux::# %.18f\n",heatFlux[25]);
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   conduction between particles in contact
+------------------------------------------------------------------------- */
+
+template <int HISTFLAG,int CONTACTAREA>
+void FixHeatGranCond::conduction_contacts(int cpl_flag,int phase)
+{
+  if(packed_state_) conduction_eval<HISTFLAG,CONTACTAREA,1>(cpl_flag,phase);
+  else conduction_eval<HISTFLAG,CONTACTAREA,0>(cpl_flag,phase);
+}
+
+/* ---------------------------------------------------------------------- */
+
+template <int HISTFLAG,int CONTACTAREA,int PACKED>
+void FixHeatGranCond::conduction_eval(int cpl_flag,int phase)
+{
+  int i,j,ii,jj,inum,jnum;
+  double xtmp,ytmp,ztmp,delx,dely,delz;
+  double radi,radj,radsum,rsq;
+  int *ilist,*jlist,*numneigh,**firstneigh;
+  int *contact_flag,**first_contact_flag;
+
+  int newton_pair = force->newton_pair;
+
+  inum = pair_gran->list->inum;
+  ilist = pair_gran->list->ilist;
+  numneigh = pair_gran->list->numneigh;
+  firstneigh = pair_gran->list->firstneigh;
+  if(HISTFLAG) first_contact_flag = pair_gran->listgranhistory->firstneigh;
+
+  double *radius = atom->radius;
+  double **x = atom->x;
+  int *type = atom->type;
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+
+  // packed mode: neighbor data is read from one record per atom
+  ThermalState *state = 0;
+  if(PACKED)
+  {
+    pack_thermal_state();
+    state = thermal_state_;
+  }
+
+  // restrict the loop to pairs involving the group
+  const bool sublist = group_sublist_;
+  if(sublist && sublist_build_ != neighbor->lastcall)
+    build_group_sublist();
+
+  const bool track = cull_track_;
+  if(track && cull_build_ != neighbor->lastcall)
+    build_cull_stamps();
+  const int nouter = sublist ? nsub_i_ : inum;
 
   // loop over neighbors of my atoms
-  for (ii = 0; ii < inum; ii++) {
+  // phase one: gather the contacts into a dense batch
+  // phase two: evaluate the batch, see conduction_batch_eval()
+
+  nbatch_ = 0;
+
+  for (int k = 0; k < nouter; k++) {
+    ii = sublist ? sub_ii_[k] : k;
     i = ilist[ii];
     xtmp = x[i][0];
     ytmp = x[i][1];
@@ -534,127 +1224,1823 @@ void FixHeatGranCond::post_force_eval(int vflag,int cpl_flag)
     jnum = numneigh[i];
     if(HISTFLAG) contact_flag = first_contact_flag[i];
 
-    for (jj = 0; jj < jnum; jj++) {
+    const int mfirst = sublist ? sub_first_[k] : 0;
+    const int mlast = sublist ? sub_first_[k+1] : jnum;
+
+    for (int m = mfirst; m < mlast; m++) {
+      jj = sublist ? sub_jj_[m] : m;
       j = jlist[jj];
       j &= NEIGHMASK;
 
-      if (!(mask[i] & groupbit) && !(mask[j] & groupbit)) continue;
+      if(CONTACTS_GHOST == phase && j < nlocal) continue;
+      if(CONTACTS_OWNED == phase && j >= nlocal) continue;
 
-      if(!HISTFLAG)
-      {
-        delx = xtmp - x[j][0];
-        dely = ytmp - x[j][1];
-        delz = ztmp - x[j][2];
-        rsq = delx*delx + dely*dely + delz*delz;
-        radj = radius[j];
-        radsum = radi + radj;
-      }
+      const ThermalState *sj = PACKED ? &state[j] : 0;
+      const int maskj = PACKED ? sj->mask : mask[j];
+      const double Tj = PACKED ? sj->Temp : Temp[j];
 
-      if ((HISTFLAG && contact_flag[jj]) || (!HISTFLAG && (rsq < radsum*radsum))) {  //contact
-        
-        if(HISTFLAG)
-        {
-          delx = xtmp - x[j][0];
-          dely = ytmp - x[j][1];
-          delz = ztmp - x[j][2];
-          rsq = delx*delx + dely*dely + delz*delz;
-          radj = radius[j];
-          radsum = radi + radj;
-          if(rsq >= radsum*radsum) continue;
-        }
+      // pairs without heat transfer are accounted up to now
+      double *stamp = track ? &cull_stamp_[cull_first_[ii]+jj] : 0;
 
-        r = sqrt(rsq);
+      if (!(mask[i] & groupbit) && !(maskj & groupbit)) {
+        if(stamp) *stamp = cull_clock_;
+        continue;
+      }
 
-        if(CONTACTAREA == CONDUCTION_CONTACT_AREA_OVERLAP)
-        {
-            
-            if(area_correction_flag_)
-            {
-              delta_n = radsum - r;
-              delta_n *= deltan_ratio_[type[i]-1][type[j]-1];
-              r = radsum - delta_n;
-            }
+      if(HISTFLAG && !contact_flag[jj]) {
+        if(stamp) *stamp = cull_clock_;
+        continue;
+      }
 
-            if (r < fmax(radi, radj)) // one sphere is inside the other
-            {
-                // set contact area to area of smaller sphere
-                contactArea = fmin(radi,radj);
-                contactArea *= contactArea * M_PI;
-            }
-            else
-                //contact area of the two spheres
-                contactArea = - M_PI/4.0 * ( (r-radi-radj)*(r+radi-radj)*(r-radi+radj)*(r+radi+radj) )/(r*r);
-        }
-        else if (CONTACTAREA == CONDUCTION_CONTACT_AREA_CONSTANT)
-            contactArea = fixed_contact_area_;
-        else if (CONTACTAREA == CONDUCTION_CONTACT_AREA_PROJECTION)
-        {
-            double rmax = std::max(radi,radj);
-            contactArea = M_PI*rmax*rmax;
-        }
-      
-        tcoi = conductivity_[type[i]-1];
-        tcoj = conductivity_[type[j]-1];
-        //tcoi = conductivity_[type[i]-1] + 0.05*Temp[i];
-        //tcoj = conductivity_[type[j]-1] + 0.05*Temp[j];
-        atom->cond[i] = tcoi;
-        atom->cond[j] = tcoj;
-        if (tcoi < SMALL_FIX_HEAT_GRAN || tcoj < SMALL_FIX_HEAT_GRAN) hc = 0.;
-        else hc = 4.*tcoi*tcoj/(tcoi+tcoj)*sqrt(contactArea);
-
-        flux = (Temp[j]-Temp[i])*hc;
-
-        dirFlux[0] = flux*delx;
-        dirFlux[1] = flux*dely;
-        dirFlux[2] = flux*delz;
-        if(!cpl_flag)
-        {
-          //Add half of the flux (located at the contact) to each particle in contact
-          heatFlux[i] += flux;
-          directionalHeatFlux[i][0] += 0.50 * dirFlux[0];
-          directionalHeatFlux[i][1] += 0.50 * dirFlux[1];
-          directionalHeatFlux[i][2] += 0.50 * dirFlux[2];
+      // no conduction within a lumped body
+      if(lumped_bodies_ && same_body(i,j)) continue;
 
-          if(store_contact_data_)
-          {
-              conduction_contact_area_[i] += contactArea;
-              n_conduction_contacts_[i] += 1.;
-          }
-          if (newton_pair || j < nlocal)
-          {
-            heatFlux[j] -= flux;
-            directionalHeatFlux[j][0] += 0.50 * dirFlux[0];
-            directionalHeatFlux[j][1] += 0.50 * dirFlux[1];
-            directionalHeatFlux[j][2] += 0.50 * dirFlux[2];
+      const double *xj = PACKED ? sj->x : x[j];
+      delx = xtmp - xj[0];
+      dely = ytmp - xj[1];
+      delz = ztmp - xj[2];
+      rsq = delx*delx + dely*dely + delz*delz;
+      radj = PACKED ? sj->radius : radius[j];
+      radsum = radi + radj;
 
-            if(store_contact_data_)
-            {
-                conduction_contact_area_[j] += contactArea;
-                n_conduction_contacts_[j] += 1.;
-            }
-          }
-        }
+      if(rsq >= radsum*radsum) {
+        if(stamp) *stamp = cull_clock_;
+        continue;
+      }
+
+      double weight = span_weight_;
+      if(cull_contacts_ && !full_sweep_ && fabs(Tj-Temp[i]) < equilibrium_tolerance_)
+      {
+        // contacts to be culled are still evaluated for the cache,
+        // but their flux is not applied
+        if(!fill_flux_cache_) continue;
+        weight = 0.;
+      }
+      else if(stamp)
+      {
+        weight = cull_clock_ - *stamp;
+        *stamp = cull_clock_;
+      }
 
-        if(cpl_flag && cpl) cpl->add_heat(i,j,flux);
+      // record each contact once
+      if(record_frame_ && !cpl_flag && (newton_pair || j < nlocal || atom->tag[i] < atom->tag[j]))
+        add_record_pair(i,j,radsum-sqrt(rsq));
+
+      //contact
+      batch_i_[nbatch_] = i;
+      batch_j_[nbatch_] = j;
+      batch_delx_[nbatch_] = delx;
+      batch_dely_[nbatch_] = dely;
+      batch_delz_[nbatch_] = delz;
+      batch_rsq_[nbatch_] = rsq;
+      batch_radi_[nbatch_] = radi;
+      batch_radj_[nbatch_] = radj;
+      batch_Ti_[nbatch_] = Temp[i];
+      batch_Tj_[nbatch_] = Tj;
+      batch_tcoi_[nbatch_] = conductivity_[type[i]-1];
+      batch_tcoj_[nbatch_] = PACKED ? sj->cond : conductivity_[type[j]-1];
+      if(area_correction_flag_)
+        batch_ratio_[nbatch_] = deltan_ratio_[type[i]-1][(PACKED ? sj->type : type[j])-1];
+      batch_weight_[nbatch_] = weight;
+
+      if(++nbatch_ == CONDUCTION_BATCH_SIZE)
+      {
+        conduction_batch_eval<CONTACTAREA>(cpl_flag,newton_pair,nlocal);
+        nbatch_ = 0;
       }
     }
   }
 
- //printf("time_conduction \n");
-  if(newton_pair)
+  if(nbatch_ > 0)
+    conduction_batch_eval<CONTACTAREA>(cpl_flag,newton_pair,nlocal);
+}
+
+/* ----------------------------------------------------------------------
+   split-phase evaluation, used with newton on
+   receives for the partial fluxes of owned atoms are posted first, then
+   contacts with ghosts are evaluated and their partial fluxes are sent to
+   the owners, radiation and contacts between owned atoms are evaluated
+   while the messages are in flight, finally the received fluxes are added
+------------------------------------------------------------------------- */
+
+template <int HISTFLAG,int CONTACTAREA>
+void FixHeatGranCond::split_phase_contacts(int cpl_flag)
+{
+  if(ghost_plan_build_ != neighbor->lastcall)
+    build_ghost_plan();
+
+  const int nval = flux_comm_size();
+  const int nsend = plan_send_proc_.size();
+  const int nrecv = plan_recv_proc_.size();
+
+  plan_send_buf_.resize(std::max(1,nval*static_cast<int>(plan_send_ghost_.size())));
+  plan_recv_buf_.resize(std::max(1,nval*static_cast<int>(plan_recv_owned_.size())));
+  plan_request_.resize(std::max(1,nsend+nrecv));
+  plan_status_.resize(std::max(1,nsend+nrecv));
+
+  for(int r = 0; r < nrecv; r++)
   {
-    fix_heatFlux->do_reverse_comm();
-    fix_directionalHeatFlux->do_reverse_comm();
-    fix_conduction_contact_area_->do_reverse_comm();
-    fix_n_conduction_contacts_->do_reverse_comm();
+    const int first = plan_recv_first_[r];
+    const int n = plan_recv_first_[r+1] - first;
+    MPI_Irecv(&plan_recv_buf_[nval*first],nval*n,MPI_DOUBLE,plan_recv_proc_[r],
+              GHOST_FLUX_TAG,world,&plan_request_[r]);
   }
 
-  if(!cpl_flag && store_contact_data_)
-  for(int i = 0; i < nlocal; i++)
+  // phase one: contacts with ghosts, then send their contributions
+  conduction_contacts<HISTFLAG,CONTACTAREA>(cpl_flag,CONTACTS_GHOST);
+
+  for(int s = 0; s < nsend; s++)
   {
-     if(n_conduction_contacts_[i] > 0.5)
-        conduction_contact_area_[i] /= n_conduction_contacts_[i];
+    const int first = plan_send_first_[s];
+    const int last = plan_send_first_[s+1];
+    int m = nval*first;
+    for(int k = first; k < last; k++)
+      m += pack_flux(plan_send_ghost_[k],&plan_send_buf_[m]);
+    MPI_Isend(&plan_send_buf_[nval*first],nval*(last-first),MPI_DOUBLE,plan_send_proc_[s],
+              GHOST_FLUX_TAG,world,&plan_request_[nrecv+s]);
+  }
+
+  // periodic images of owned atoms
+  double self_buf[7];
+  for(size_t k = 0; k < plan_self_ghost_.size(); k++)
+  {
+    pack_flux(plan_self_ghost_[k],self_buf);
+    unpack_flux(plan_self_owned_[k],self_buf);
+  }
+
+  // phase two: contacts between owned atoms, these do not touch ghosts
+  radiation_eval(cpl_flag);
+  conduction_contacts<HISTFLAG,CONTACTAREA>(cpl_flag,CONTACTS_OWNED);
+
+  // ranks are unpacked in a fixed order, so the sum does not depend
+  // on the order in which messages arrive
+  if(nrecv > 0)
+    MPI_Waitall(nrecv,&plan_request_[0],&plan_status_[0]);
+  for(int r = 0; r < nrecv; r++)
+  {
+    int m = nval*plan_recv_first_[r];
+    for(int k = plan_recv_first_[r]; k < plan_recv_first_[r+1]; k++)
+      m += unpack_flux(plan_recv_owned_[k],&plan_recv_buf_[m]);
+  }
+  if(nsend > 0)
+    MPI_Waitall(nsend,&plan_request_[nrecv],&plan_status_[nrecv]);
+}
+
+/* ----------------------------------------------------------------------
+   ghost temperatures for the fused integrator
+   compressed mode: each owner sends index/value pairs to the ranks holding
+   its ghosts, every rank sends one message to each of these ranks so the
+   receiver knows what to wait for; a full refresh sends the plain values
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::forward_temperature()
+{
+  if(!temp_comm_compress_)
+  {
+    FixHeatGran::forward_temperature();
+    return;
+  }
+
+  bool full = last_temp_refresh_ < 0 || update->ntimestep - last_temp_refresh_ >= temp_comm_refresh_;
+  if(ghost_plan_build_ != neighbor->lastcall)
+  {
+    build_ghost_plan();
+    full = true;
+  }
+  if(full)
+  {
+    plan_temp_sent_.resize(plan_recv_owned_.size());
+    last_temp_refresh_ = update->ntimestep;
+  }
+
+  // owned atoms are sent to plan_recv_proc_, ghosts come from plan_send_proc_
+  const int nsend = plan_recv_proc_.size();
+  const int nrecv = plan_send_proc_.size();
+
+  temp_send_buf_.resize(std::max(1,2*static_cast<int>(plan_recv_owned_.size())));
+  temp_recv_buf_.resize(std::max(1,2*static_cast<int>(plan_send_ghost_.size())));
+  plan_request_.resize(std::max(1,nsend+nrecv));
+  plan_status_.resize(std::max(1,nsend+nrecv));
+
+  for(int r = 0; r < nrecv; r++)
+  {
+    const int first = plan_send_first_[r];
+    const int n = plan_send_first_[r+1] - first;
+    MPI_Irecv(&temp_recv_buf_[2*first],2*n,MPI_DOUBLE,plan_send_proc_[r],
+              GHOST_TEMP_TAG,world,&plan_request_[r]);
+  }
+
+  for(int s = 0; s < nsend; s++)
+  {
+    const int first = plan_recv_first_[s];
+    const int last = plan_recv_first_[s+1];
+    int m = 2*first;
+    for(int k = first; k < last; k++)
+    {
+      const double T = Temp[plan_recv_owned_[k]];
+      if(full)
+        temp_send_buf_[m++] = T;
+      else if(fabs(T-plan_temp_sent_[k]) > temp_comm_tol_*fabs(plan_temp_sent_[k]))
+      {
+        temp_send_buf_[m++] = static_cast<double>(k-first);
+        temp_send_buf_[m++] = T;
+      }
+      else
+        continue;
+      plan_temp_sent_[k] = T;
+    }
+    MPI_Isend(&temp_send_buf_[2*first],m-2*first,MPI_DOUBLE,plan_recv_proc_[s],
+              GHOST_TEMP_TAG,world,&plan_request_[nrecv+s]);
+  }
+
+  // periodic images of owned atoms
+  for(size_t k = 0; k < plan_self_ghost_.size(); k++)
+    Temp[plan_self_ghost_[k]] = Temp[plan_self_owned_[k]];
+
+  if(nrecv > 0)
+    MPI_Waitall(nrecv,&plan_request_[0],&plan_status_[0]);
+  for(int r = 0; r < nrecv; r++)
+  {
+    const int first = plan_send_first_[r];
+    int count;
+    MPI_Get_count(&plan_status_[r],MPI_DOUBLE,&count);
+    if(full)
+    {
+      for(int m = 0; m < count; m++)
+        Temp[plan_send_ghost_[first+m]] = temp_recv_buf_[2*first+m];
+    }
+    else
+    {
+      for(int m = 0; m < count; m += 2)
+        Temp[plan_send_ghost_[first+static_cast<int>(temp_recv_buf_[2*first+m])]] = temp_recv_buf_[2*first+m+1];
+    }
+  }
+  if(nsend > 0)
+    MPI_Waitall(nsend,&plan_request_[nrecv],&plan_status_[nrecv]);
+}
+
+/* ----------------------------------------------------------------------
+   owner rank and owner index of each ghost, by forward communication
+   each rank then sends the owner indices of its ghosts to their owners,
+   the number of ranks to receive from is found as in Irregular
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::build_ghost_plan()
+{
+  const int nlocal = atom->nlocal;
+  const int nall = nlocal + atom->nghost;
+  const int me = comm->me;
+  const int nprocs = comm->nprocs;
+
+  if(atom->nmax > nmax_ghost_plan_)
+  {
+    nmax_ghost_plan_ = atom->nmax;
+    memory->destroy(ghost_owner_);
+    memory->destroy(ghost_index_);
+    memory->create(ghost_owner_,nmax_ghost_plan_,"heat/gran/conduction:ghost_owner_");
+    memory->create(ghost_index_,nmax_ghost_plan_,"heat/gran/conduction:ghost_index_");
+  }
+
+  for(int i = 0; i < nlocal; i++)
+  {
+    ghost_owner_[i] = static_cast<double>(me);
+    ghost_index_[i] = static_cast<double>(i);
+  }
+  comm_owner_ = true;
+  comm->forward_comm_fix(this);
+  comm_owner_ = false;
+
+  // ghosts sorted by owner rank, then by ghost index
+  std::vector<std::pair<int,int> > owner;
+  owner.reserve(nall-nlocal);
+  plan_self_ghost_.clear();
+  plan_self_owned_.clear();
+  for(int i = nlocal; i < nall; i++)
+  {
+    const int p = static_cast<int>(ghost_owner_[i]);
+    if(p == me)
+    {
+      plan_self_ghost_.push_back(i);
+      plan_self_owned_.push_back(static_cast<int>(ghost_index_[i]));
+    }
+    else
+      owner.push_back(std::make_pair(p,i));
+  }
+  std::sort(owner.begin(),owner.end());
+
+  plan_send_proc_.clear();
+  plan_send_first_.clear();
+  plan_send_ghost_.resize(owner.size());
+  std::vector<int> send_index(owner.size());
+  for(size_t k = 0; k < owner.size(); k++)
+  {
+    if(0 == k || owner[k].first != owner[k-1].first)
+    {
+      plan_send_proc_.push_back(owner[k].first);
+      plan_send_first_.push_back(k);
+    }
+    plan_send_ghost_[k] = owner[k].second;
+    send_index[k] = static_cast<int>(ghost_index_[owner[k].second]);
+  }
+  plan_send_first_.push_back(owner.size());
+  const int nsend = plan_send_proc_.size();
+
+  std::vector<int> proc_flag(nprocs,0), proc_count(nprocs,1);
+  for(int s = 0; s < nsend; s++)
+    proc_flag[plan_send_proc_[s]] = 1;
+  int nrecv = 0;
+  MPI_Reduce_scatter(&proc_flag[0],&nrecv,&proc_count[0],MPI_INT,MPI_SUM,world);
+
+  std::vector<MPI_Request> request(std::max(1,nsend));
+  std::vector<MPI_Status> status(std::max(1,nsend));
+  for(int s = 0; s < nsend; s++)
+    MPI_Isend(&send_index[plan_send_first_[s]],plan_send_first_[s+1]-plan_send_first_[s],MPI_INT,
+              plan_send_proc_[s],GHOST_PLAN_TAG,world,&request[s]);
+
+  // owned atoms that are ghosts on other ranks, sorted by rank
+  std::vector<std::pair<int,std::vector<int> > > recv(nrecv);
+  for(int r = 0; r < nrecv; r++)
+  {
+    MPI_Status probe;
+    int n;
+    MPI_Probe(MPI_ANY_SOURCE,GHOST_PLAN_TAG,world,&probe);
+    MPI_Get_count(&probe,MPI_INT,&n);
+    recv[r].first = probe.MPI_SOURCE;
+    recv[r].second.resize(std::max(1,n));
+    MPI_Recv(&recv[r].second[0],n,MPI_INT,probe.MPI_SOURCE,GHOST_PLAN_TAG,world,&probe);
+    recv[r].second.resize(n);
+  }
+  std::sort(recv.begin(),recv.end());
+
+  plan_recv_proc_.resize(nrecv);
+  plan_recv_first_.resize(nrecv+1);
+  plan_recv_owned_.clear();
+  for(int r = 0; r < nrecv; r++)
+  {
+    plan_recv_proc_[r] = recv[r].first;
+    plan_recv_first_[r] = plan_recv_owned_.size();
+    plan_recv_owned_.insert(plan_recv_owned_.end(),recv[r].second.begin(),recv[r].second.end());
+  }
+  plan_recv_first_[nrecv] = plan_recv_owned_.size();
+
+  if(nsend > 0)
+    MPI_Waitall(nsend,&request[0],&status[0]);
+
+  ghost_plan_build_ = neighbor->lastcall;
+}
+
+/* ----------------------------------------------------------------------
+   sublist of the pairs that involve the group, rebuilt with the
+   neighbor list; entries are indices into ilist and into the
+   neighbor lists, so contact history flags stay valid
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::build_group_sublist()
+{
+  int inum = pair_gran->list->inum;
+  int *ilist = pair_gran->list->ilist;
+  int *numneigh = pair_gran->list->numneigh;
+  int **firstneigh = pair_gran->list->firstneigh;
+  int *mask = atom->mask;
+
+  if(inum+1 > maxsub_i_)
+  {
+    maxsub_i_ = inum+1;
+    memory->grow(sub_ii_,maxsub_i_,"heat/gran:sub_ii_");
+    memory->grow(sub_first_,maxsub_i_,"heat/gran:sub_first_");
+  }
+
+  nsub_i_ = 0;
+  int nsub_j = 0;
+
+  for (int ii = 0; ii < inum; ii++)
+  {
+    const int i = ilist[ii];
+    const int *jlist = firstneigh[i];
+    const int jnum = numneigh[i];
+    const bool igroup = mask[i] & groupbit;
+    const int first = nsub_j;
+
+    for (int jj = 0; jj < jnum; jj++)
+    {
+      const int j = jlist[jj] & NEIGHMASK;
+      if(!igroup && !(mask[j] & groupbit)) continue;
+
+      if(nsub_j == maxsub_j_)
+      {
+        maxsub_j_ += DELTA_SUBLIST;
+        memory->grow(sub_jj_,maxsub_j_,"heat/gran:sub_jj_");
+      }
+      sub_jj_[nsub_j++] = jj;
+    }
+
+    if(nsub_j > first)
+    {
+      sub_ii_[nsub_i_] = ii;
+      sub_first_[nsub_i_] = first;
+      nsub_i_++;
+    }
+  }
+  sub_first_[nsub_i_] = nsub_j;
+
+  sublist_build_ = neighbor->lastcall;
+}
+
+/* ----------------------------------------------------------------------
+   culling stamps, one per neighbor list entry, rebuilt with the
+   neighbor list; skipped steps of contacts culled before a rebuild
+   are dropped for both particles, so energy is still conserved
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::build_cull_stamps()
+{
+  int inum = pair_gran->list->inum;
+  int *ilist = pair_gran->list->ilist;
+  int *numneigh = pair_gran->list->numneigh;
+
+  if(inum+1 > maxcull_i_)
+  {
+    maxcull_i_ = inum+1;
+    memory->grow(cull_first_,maxcull_i_,"heat/gran:cull_first_");
+  }
+
+  int n = 0;
+  for (int ii = 0; ii < inum; ii++)
+  {
+    cull_first_[ii] = n;
+    n += numneigh[ilist[ii]];
+  }
+  cull_first_[inum] = n;
+
+  if(n > maxcull_)
+  {
+    maxcull_ = n;
+    memory->grow(cull_stamp_,maxcull_,"heat/gran:cull_stamp_");
+  }
+
+  // entries of the new list are accounted up to the previous evaluation
+  const double clock = cull_clock_ - span_weight_;
+  for (int k = 0; k < n; k++)
+    cull_stamp_[k] = clock;
+
+  cull_build_ = neighbor->lastcall;
+}
+
+/* ----------------------------------------------------------------------
+   gather the per-atom data read for neighbors in the conduction loop
+   into one record per atom, owned and ghost atoms
+   all records are rebuilt after reneighboring, otherwise only position
+   and temperature change: owned records are refreshed here, ghost
+   records in unpack_comm()
+   the named properties remain the reference for dumps, restarts and
+   migration
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::pack_thermal_state()
+{
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  double *radius = atom->radius;
+  double **x = atom->x;
+  int *type = atom->type;
+  int *mask = atom->mask;
+
+  if(nmax_thermal_state_ < atom->nmax)
+  {
+    nmax_thermal_state_ = atom->nmax;
+    memory->sfree(thermal_state_mem_);
+    const size_t align = 64;
+    thermal_state_mem_ = static_cast<char*>(memory->smalloc(nmax_thermal_state_*sizeof(ThermalState)+align,"heat/gran:thermal_state_"));
+    size_t offset = reinterpret_cast<size_t>(thermal_state_mem_) % align;
+    thermal_state_ = reinterpret_cast<ThermalState*>(thermal_state_mem_ + (offset ? align-offset : 0));
+    state_build_ = -1;
+  }
+
+  if(state_build_ == neighbor->lastcall)
+  {
+    for(int i = 0; i < nlocal; i++)
+    {
+      ThermalState &si = thermal_state_[i];
+      si.x[0] = x[i][0];
+      si.x[1] = x[i][1];
+      si.x[2] = x[i][2];
+      si.Temp = Temp[i];
+    }
+
+    comm_state_ = true;
+    comm->forward_comm_fix(this);
+    comm_state_ = false;
+    return;
+  }
+
+  for(int i = 0; i < nall; i++)
+  {
+    ThermalState &si = thermal_state_[i];
+    si.x[0] = x[i][0];
+    si.x[1] = x[i][1];
+    si.x[2] = x[i][2];
+    si.radius = radius[i];
+    si.Temp = Temp[i];
+    si.cond = conductivity_[type[i]-1];
+    si.mask = mask[i];
+    si.type = type[i];
+    si.unused = 0.;
+  }
+
+  state_build_ = neighbor->lastcall;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGranCond::grow_subcycle()
+{
+  if(nmax_subcycle_ < atom->nmax)
+  {
+    nmax_subcycle_ = atom->nmax;
+    memory->grow(sub_temp_,nmax_subcycle_,"heat/gran:sub_temp_");
+    memory->grow(sub_flux_,nmax_subcycle_,"heat/gran:sub_flux_");
+    memory->grow(sub_flux_avg_,nmax_subcycle_,"heat/gran:sub_flux_avg_");
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGranCond::final_integrate()
+{
+  if(subcycle_pending_)
+  {
+    subcycle_pending_ = false;
+
+    if(history_flag == 0 && CONDUCTION_CONTACT_AREA_OVERLAP == area_calculation_mode_)
+      thermal_subcycle<0,CONDUCTION_CONTACT_AREA_OVERLAP>();
+    if(history_flag == 1 && CONDUCTION_CONTACT_AREA_OVERLAP == area_calculation_mode_)
+      thermal_subcycle<1,CONDUCTION_CONTACT_AREA_OVERLAP>();
+
+    if(history_flag == 0 && CONDUCTION_CONTACT_AREA_CONSTANT == area_calculation_mode_)
+      thermal_subcycle<0,CONDUCTION_CONTACT_AREA_CONSTANT>();
+    if(history_flag == 1 && CONDUCTION_CONTACT_AREA_CONSTANT == area_calculation_mode_)
+      thermal_subcycle<1,CONDUCTION_CONTACT_AREA_CONSTANT>();
+
+    if(history_flag == 0 && CONDUCTION_CONTACT_AREA_PROJECTION == area_calculation_mode_)
+      thermal_subcycle<0,CONDUCTION_CONTACT_AREA_PROJECTION>();
+    if(history_flag == 1 && CONDUCTION_CONTACT_AREA_PROJECTION == area_calculation_mode_)
+      thermal_subcycle<1,CONDUCTION_CONTACT_AREA_PROJECTION>();
+  }
+
+  FixHeatGran::final_integrate();
+}
+
+/* ----------------------------------------------------------------------
+   thermal sub-cycling
+   the first sub-step was evaluated by post_force_eval() into sub_flux_,
+   the remaining ones advance a scratch temperature with the particle heat
+   fluxes and the wall fluxes at the scratch temperature; the mean flux over
+   all sub-steps is added to heatFlux, so the temperature integrated by the
+   transport equation matches the end of the sub-cycle
+   fix wall/gran adds the wall flux at the start temperature once per step,
+   only the change over the sub-steps is added here
+------------------------------------------------------------------------- */
+
+template <int HISTFLAG,int CONTACTAREA>
+void FixHeatGranCond::thermal_subcycle()
+{
+  const int nsub = thermal_subcycles_;
+  const double dtsub = update->dt/static_cast<double>(nsub);
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  int newton_pair = force->newton_pair;
+  double *rmass = atom->rmass;
+  int *type = atom->type;
+  int *mask = atom->mask;
+
+  updatePtrs();
+
+  // sum of wall conductances and of conductance times wall temperature
+  double *wall_hc = fix_wall_conductance_->vector_atom;
+  double *wall_hct = fix_wall_conductance_temp_->vector_atom;
+
+  for(int i = 0; i < nall; i++)
+    sub_temp_[i] = Temp[i];
+  for(int i = 0; i < nlocal; i++)
+    sub_flux_avg_[i] = sub_flux_[i];
+
+  // sub-steps only compute heat fluxes
+  double *Temp_step = Temp;
+  double *heatFlux_step = heatFlux;
+  const bool directional_flux = directional_flux_;
+  const bool store_contact_data = store_contact_data_;
+  const bool fill_flux_cache = fill_flux_cache_;
+  const bool assemble_network = assemble_network_;
+  const bool record_frame = record_frame_;
+  directional_flux_ = store_contact_data_ = fill_flux_cache_ = assemble_network_ = record_frame_ = false;
+  accumulate_conductance_ = false;
+
+  Temp = sub_temp_;
+  heatFlux = sub_flux_;
+
+  for(int isub = 1; isub < nsub; isub++)
+  {
+    for(int i = 0; i < nlocal; i++)
+      if(mask[i] & groupbit)
+        sub_temp_[i] += (sub_flux_[i]+heatSource[i]+wall_hct[i]-wall_hc[i]*sub_temp_[i])*dtsub/(rmass[i]*capacity_[type[i]-1]);
+
+    comm_vec_[0] = sub_temp_;
+    comm_nvec_ = 1;
+    comm->forward_comm_fix(this);
+    comm_nvec_ = 0;
+
+    for(int i = 0; i < nall; i++)
+      sub_flux_[i] = 0.;
+
+    radiation_eval(0);
+    conduction_contacts<HISTFLAG,CONTACTAREA>(0,CONTACTS_ALL);
+
+    if(newton_pair)
+      comm->reverse_comm_fix(this);
+
+    for(int i = 0; i < nlocal; i++)
+      sub_flux_avg_[i] += sub_flux_[i] - wall_hc[i]*(sub_temp_[i]-Temp_step[i]);
+  }
+
+  Temp = Temp_step;
+  heatFlux = heatFlux_step;
+  directional_flux_ = directional_flux;
+  store_contact_data_ = store_contact_data;
+  fill_flux_cache_ = fill_flux_cache;
+  assemble_network_ = assemble_network;
+  record_frame_ = record_frame;
+  accumulate_conductance_ = true;
+
+  for(int i = 0; i < nlocal; i++)
+    heatFlux[i] += sub_flux_avg_[i]/static_cast<double>(nsub);
+}
+
+/* ----------------------------------------------------------------------
+   SIMD kernels for the dense part of conduction_batch_eval()
+   they use the same operations in the same order as the scalar loop,
+   each returns the number of contacts done, the rest is done scalar
+------------------------------------------------------------------------- */
+
+enum{ BATCH_KERNEL_SCALAR, BATCH_KERNEL_AVX2, BATCH_KERNEL_AVX512 };
+
+#ifdef FIX_HEAT_GRAN_BATCH_SIMD
+
+template <int CONTACTAREA>
+__attribute__((target("avx2")))
+static int batch_kernel_avx2(int n,int area_correction,double const_area,
+                             const double *rsq,const double *radi,const double *radj,const double *ratio,
+                             const double *Ti,const double *Tj,const double *tcoi,const double *tcoj,
+                             double *area,double *hc,double *flux)
+{
+  const __m256d pi = _mm256_set1_pd(M_PI);
+  const __m256d mpi4 = _mm256_set1_pd(- M_PI/4.0);
+  const __m256d four = _mm256_set1_pd(4.);
+  const __m256d small = _mm256_set1_pd(SMALL_FIX_HEAT_GRAN);
+  const __m256d zero = _mm256_setzero_pd();
+  const int nvec = n - n%4;
+
+  for (int k = 0; k < nvec; k += 4)
+  {
+    __m256d a;
+    if(CONTACTAREA == CONDUCTION_CONTACT_AREA_OVERLAP)
+    {
+      const __m256d ri = _mm256_loadu_pd(radi+k);
+      const __m256d rj = _mm256_loadu_pd(radj+k);
+      __m256d r = _mm256_sqrt_pd(_mm256_loadu_pd(rsq+k));
+      if(area_correction)
+      {
+        const __m256d radsum = _mm256_add_pd(ri,rj);
+        r = _mm256_sub_pd(radsum,_mm256_mul_pd(_mm256_sub_pd(radsum,r),_mm256_loadu_pd(ratio+k)));
+      }
+      const __m256d rmin = _mm256_min_pd(ri,rj);
+      const __m256d rmax = _mm256_max_pd(ri,rj);
+      const __m256d area_inside = _mm256_mul_pd(_mm256_mul_pd(pi,rmin),rmin);
+      const __m256d rm = _mm256_sub_pd(r,ri);
+      const __m256d rp = _mm256_add_pd(r,ri);
+      __m256d prod = _mm256_mul_pd(_mm256_sub_pd(rm,rj),_mm256_sub_pd(rp,rj));
+      prod = _mm256_mul_pd(prod,_mm256_add_pd(rm,rj));
+      prod = _mm256_mul_pd(prod,_mm256_add_pd(rp,rj));
+      const __m256d area_overlap = _mm256_div_pd(_mm256_mul_pd(mpi4,prod),_mm256_mul_pd(r,r));
+      a = _mm256_blendv_pd(area_overlap,area_inside,_mm256_cmp_pd(r,rmax,_CMP_LT_OQ));
+    }
+    else if (CONTACTAREA == CONDUCTION_CONTACT_AREA_CONSTANT)
+      a = _mm256_set1_pd(const_area);
+    else
+    {
+      const __m256d rmax = _mm256_max_pd(_mm256_loadu_pd(radi+k),_mm256_loadu_pd(radj+k));
+      a = _mm256_mul_pd(_mm256_mul_pd(pi,rmax),rmax);
+    }
+
+    const __m256d ci = _mm256_loadu_pd(tcoi+k);
+    const __m256d cj = _mm256_loadu_pd(tcoj+k);
+    const __m256d off = _mm256_or_pd(_mm256_cmp_pd(ci,small,_CMP_LT_OQ),_mm256_cmp_pd(cj,small,_CMP_LT_OQ));
+    __m256d h = _mm256_div_pd(_mm256_mul_pd(_mm256_mul_pd(four,ci),cj),_mm256_add_pd(ci,cj));
+    h = _mm256_blendv_pd(_mm256_mul_pd(h,_mm256_sqrt_pd(a)),zero,off);
+
+    _mm256_storeu_pd(area+k,a);
+    _mm256_storeu_pd(hc+k,h);
+    _mm256_storeu_pd(flux+k,_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(Tj+k),_mm256_loadu_pd(Ti+k)),h));
+  }
+  return nvec;
+}
+
+/* ---------------------------------------------------------------------- */
+
+template <int CONTACTAREA>
+__attribute__((target("avx512f")))
+static int batch_kernel_avx512(int n,int area_correction,double const_area,
+                               const double *rsq,const double *radi,const double *radj,const double *ratio,
+                               const double *Ti,const double *Tj,const double *tcoi,const double *tcoj,
+                               double *area,double *hc,double *flux)
+{
+  const __m512d pi = _mm512_set1_pd(M_PI);
+  const __m512d mpi4 = _mm512_set1_pd(- M_PI/4.0);
+  const __m512d four = _mm512_set1_pd(4.);
+  const __m512d small = _mm512_set1_pd(SMALL_FIX_HEAT_GRAN);
+  const __m512d zero = _mm512_setzero_pd();
+  const int nvec = n - n%8;
+
+  for (int k = 0; k < nvec; k += 8)
+  {
+    __m512d a;
+    if(CONTACTAREA == CONDUCTION_CONTACT_AREA_OVERLAP)
+    {
+      const __m512d ri = _mm512_loadu_pd(radi+k);
+      const __m512d rj = _mm512_loadu_pd(radj+k);
+      __m512d r = _mm512_sqrt_pd(_mm512_loadu_pd(rsq+k));
+      if(area_correction)
+      {
+        const __m512d radsum = _mm512_add_pd(ri,rj);
+        r = _mm512_sub_pd(radsum,_mm512_mul_pd(_mm512_sub_pd(radsum,r),_mm512_loadu_pd(ratio+k)));
+      }
+      const __m512d rmin = _mm512_min_pd(ri,rj);
+      const __m512d rmax = _mm512_max_pd(ri,rj);
+      const __m512d area_inside = _mm512_mul_pd(_mm512_mul_pd(pi,rmin),rmin);
+      const __m512d rm = _mm512_sub_pd(r,ri);
+      const __m512d rp = _mm512_add_pd(r,ri);
+      __m512d prod = _mm512_mul_pd(_mm512_sub_pd(rm,rj),_mm512_sub_pd(rp,rj));
+      prod = _mm512_mul_pd(prod,_mm512_add_pd(rm,rj));
+      prod = _mm512_mul_pd(prod,_mm512_add_pd(rp,rj));
+      const __m512d area_overlap = _mm512_div_pd(_mm512_mul_pd(mpi4,prod),_mm512_mul_pd(r,r));
+      a = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(r,rmax,_CMP_LT_OQ),area_overlap,area_inside);
+    }
+    else if (CONTACTAREA == CONDUCTION_CONTACT_AREA_CONSTANT)
+      a = _mm512_set1_pd(const_area);
+    else
+    {
+      const __m512d rmax = _mm512_max_pd(_mm512_loadu_pd(radi+k),_mm512_loadu_pd(radj+k));
+      a = _mm512_mul_pd(_mm512_mul_pd(pi,rmax),rmax);
+    }
+
+    const __m512d ci = _mm512_loadu_pd(tcoi+k);
+    const __m512d cj = _mm512_loadu_pd(tcoj+k);
+    const __mmask8 off = _mm512_cmp_pd_mask(ci,small,_CMP_LT_OQ) | _mm512_cmp_pd_mask(cj,small,_CMP_LT_OQ);
+    __m512d h = _mm512_div_pd(_mm512_mul_pd(_mm512_mul_pd(four,ci),cj),_mm512_add_pd(ci,cj));
+    h = _mm512_mask_blend_pd(off,_mm512_mul_pd(h,_mm512_sqrt_pd(a)),zero);
+
+    _mm512_storeu_pd(area+k,a);
+    _mm512_storeu_pd(hc+k,h);
+    _mm512_storeu_pd(flux+k,_mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(Tj+k),_mm512_loadu_pd(Ti+k)),h));
+  }
+  return nvec;
+}
+
+#endif
+
+/* ----------------------------------------------------------------------
+   widest batch kernel supported by the CPU this process runs on
+------------------------------------------------------------------------- */
+
+int FixHeatGranCond::select_batch_kernel()
+{
+#ifdef FIX_HEAT_GRAN_BATCH_SIMD
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f"))
+    return BATCH_KERNEL_AVX512;
+  if(__builtin_cpu_supports("avx2"))
+    return BATCH_KERNEL_AVX2;
+#endif
+  return BATCH_KERNEL_SCALAR;
+}
+
+/* ----------------------------------------------------------------------
+   evaluate a batch of gathered contacts
+   contact area, conductance and flux are computed in a dense loop
+   without indirect access, by a SIMD kernel if available, the scalar
+   loop does the remainder; fluxes are scatter-added afterwards
+------------------------------------------------------------------------- */
+
+template <int CONTACTAREA>
+void FixHeatGranCond::conduction_batch_eval(int cpl_flag,int newton_pair,int nlocal)
+{
+  const int n = nbatch_;
+  int kfirst = 0;
+
+#ifdef FIX_HEAT_GRAN_BATCH_SIMD
+  if(BATCH_KERNEL_AVX512 == batch_simd_)
+    kfirst = batch_kernel_avx512<CONTACTAREA>(n,area_correction_flag_,cg_contact_area_,
+                                              batch_rsq_,batch_radi_,batch_radj_,batch_ratio_,
+                                              batch_Ti_,batch_Tj_,batch_tcoi_,batch_tcoj_,
+                                              batch_area_,batch_hc_,batch_flux_);
+  else if(BATCH_KERNEL_AVX2 == batch_simd_)
+    kfirst = batch_kernel_avx2<CONTACTAREA>(n,area_correction_flag_,cg_contact_area_,
+                                            batch_rsq_,batch_radi_,batch_radj_,batch_ratio_,
+                                            batch_Ti_,batch_Tj_,batch_tcoi_,batch_tcoj_,
+                                            batch_area_,batch_hc_,batch_flux_);
+#endif
+
+  for (int k = kfirst; k < n; k++)
+  {
+    const double radi = batch_radi_[k];
+    const double radj = batch_radj_[k];
+    double r = sqrt(batch_rsq_[k]);
+    double contactArea;
+
+    if(CONTACTAREA == CONDUCTION_CONTACT_AREA_OVERLAP)
+    {
+        if(area_correction_flag_)
+        {
+          const double radsum = radi + radj;
+          r = radsum - (radsum - r)*batch_ratio_[k];
+        }
+
+        // if one sphere is inside the other, use area of smaller sphere
+        // else contact area of the two spheres
+        const double rmin = fmin(radi,radj);
+        const double area_inside = M_PI*rmin*rmin;
+        const double area_overlap = - M_PI/4.0 * ( (r-radi-radj)*(r+radi-radj)*(r-radi+radj)*(r+radi+radj) )/(r*r);
+        contactArea = (r < fmax(radi,radj)) ? area_inside : area_overlap;
+    }
+    else if (CONTACTAREA == CONDUCTION_CONTACT_AREA_CONSTANT)
+        contactArea = cg_contact_area_;
+    else
+    {
+        const double rmax = fmax(radi,radj);
+        contactArea = M_PI*rmax*rmax;
+    }
+
+    const double tcoi = batch_tcoi_[k];
+    const double tcoj = batch_tcoj_[k];
+    const double hc = (tcoi < SMALL_FIX_HEAT_GRAN || tcoj < SMALL_FIX_HEAT_GRAN) ?
+                      0. : 4.*tcoi*tcoj/(tcoi+tcoj)*sqrt(contactArea);
+
+    batch_area_[k] = contactArea;
+    batch_hc_[k] = hc;
+    batch_flux_[k] = (batch_Tj_[k]-batch_Ti_[k])*hc;
+  }
+
+  // scatter-add
+
+  for (int k = 0; k < n; k++)
+  {
+    const int i = batch_i_[k];
+    const int j = batch_j_[k];
+    const double flux = batch_flux_[k]*batch_weight_[k];
+
+    if(fill_flux_cache_) add_to_flux_cache(i,j,batch_flux_[k]);
+    if(assemble_network_ && batch_hc_[k] > 0.) add_to_network(i,j,batch_hc_[k]);
+
+    total_heat_ += fabs(flux);
+    if(batch_weight_[k] > span_weight_)
+      culled_heat_ += fabs(batch_flux_[k])*(batch_weight_[k]-span_weight_);
+
+    atom->cond[i] = batch_tcoi_[k];
+    atom->cond[j] = batch_tcoj_[k];
+
+    if(!cpl_flag)
+    {
+      if(accumulate_conductance_)
+      {
+        conductance_[i] += batch_hc_[k];
+        if(newton_pair || j < nlocal)
+          conductance_[j] += batch_hc_[k];
+      }
+
+      //Add half of the flux (located at the contact) to each particle in contact
+      heatFlux[i] += flux;
+      if(directional_flux_)
+      {
+        directionalHeatFlux[i][0] += 0.50 * flux*batch_delx_[k];
+        directionalHeatFlux[i][1] += 0.50 * flux*batch_dely_[k];
+        directionalHeatFlux[i][2] += 0.50 * flux*batch_delz_[k];
+      }
+
+      // culled contacts evaluated only for the flux cache are not counted
+      if(store_contact_data_ && batch_weight_[k] > 0.)
+      {
+          conduction_contact_area_[i] += batch_area_[k];
+          n_conduction_contacts_[i] += 1.;
+      }
+      if (newton_pair || j < nlocal)
+      {
+        heatFlux[j] -= flux;
+        if(directional_flux_)
+        {
+          directionalHeatFlux[j][0] += 0.50 * flux*batch_delx_[k];
+          directionalHeatFlux[j][1] += 0.50 * flux*batch_dely_[k];
+          directionalHeatFlux[j][2] += 0.50 * flux*batch_delz_[k];
+        }
+
+        if(store_contact_data_ && batch_weight_[k] > 0.)
+        {
+            conduction_contact_area_[j] += batch_area_[k];
+            n_conduction_contacts_[j] += 1.;
+        }
+      }
+    }
+
+    if(cpl_flag && cpl) cpl->add_heat(i,j,batch_flux_[k]);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   check for equilibrium culling, called on full sweep steps
+   culled contacts exchange heat pairwise, so energy is conserved exactly;
+   their heat transfer is however lagged by up to full_sweep_every steps,
+   so warn if they carry a relevant part of the total heat transfer
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::check_equilibrium_culling()
+{
+  double heat[2] = {culled_heat_, total_heat_};
+  MPI_Sum_Vector(heat,2,world);
+
+  if(!culling_warned_ && heat[1] > 0. && heat[0] > 0.01*heat[1])
+  {
+    culling_warned_ = true;
+    if(comm->me == 0)
+      error->warning(FLERR,"Fix heat/gran/conduction: contacts culled via 'equilibrium_tolerance' carry more than 1% "
+                           "of the conductive heat transfer, consider reducing 'equilibrium_tolerance' or 'full_sweep_every'");
+  }
+}
+
+/* ----------------------------------------------------------------------
+   store per-contact flux for compute pair/gran/local
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::add_to_flux_cache(int i,int j,double flux)
+{
+  if(ncache_ == maxcache_)
+  {
+    maxcache_ += DELTA_FLUX_CACHE;
+    memory->grow(cache_i_,maxcache_,"heat/gran:cache_i_");
+    memory->grow(cache_j_,maxcache_,"heat/gran:cache_j_");
+    memory->grow(cache_flux_,maxcache_,"heat/gran:cache_flux_");
+  }
+  cache_i_[ncache_] = i;
+  cache_j_[ncache_] = j;
+  cache_flux_[ncache_] = flux;
+  ncache_++;
+}
+
+/* ----------------------------------------------------------------------
+   store conductance of a contact for the steady-state solver
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::add_to_network(int i,int j,double hc)
+{
+  if(nnet_ == maxnet_)
+  {
+    maxnet_ += DELTA_NETWORK;
+    memory->grow(net_i_,maxnet_,"heat/gran:net_i_");
+    memory->grow(net_j_,maxnet_,"heat/gran:net_j_");
+    memory->grow(net_hc_,maxnet_,"heat/gran:net_hc_");
+  }
+  net_i_[nnet_] = i;
+  net_j_[nnet_] = j;
+  net_hc_[nnet_] = hc;
+  nnet_++;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGranCond::end_of_step()
+{
+  // wall conductances of this step are complete now
+  if(accumulate_conductance_ && conductance_step_ == update->ntimestep && fix_wall_conductance_)
+  {
+    double *wall_hc = fix_wall_conductance_->vector_atom;
+    int nlocal = atom->nlocal;
+    for(int i = 0; i < nlocal; i++)
+      conductance_[i] += wall_hc[i];
+  }
+
+  if(thermal_control_ && thermal_eval_step_)
+  {
+    update_thermal_timestep();
+    thermal_eval_step_ = false;
+  }
+
+  if(record_frame_)
+  {
+    write_contact_frame();
+    record_frame_ = false;
+  }
+
+  if(!assemble_network_) return;
+
+  solve_steady_state();
+  assemble_network_ = false;
+}
+
+/* ----------------------------------------------------------------------
+   report replayed contacts whose partner was not found
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::post_run()
+{
+  FixHeatGran::post_run();
+
+  if(!replay_) return;
+
+  bigint missing = replay_missing_;
+  MPI_Allreduce(&replay_missing_,&missing,1,MPI_LMP_BIGINT,MPI_SUM,world);
+  replay_missing_ = 0;
+
+  if(missing > 0 && comm->me == 0)
+  {
+    char msg[200];
+    sprintf(msg,"Fix heat/gran/conduction: " BIGINT_FORMAT " replayed contacts were skipped because the contact partner "
+                "was not present on the proc, consider increasing the ghost cutoff via 'communicate single cutoff'",missing);
+    error->warning(FLERR,msg);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   solve for the steady temperature field of the conductance network
+   assembled in post_force()
+   particles in the group are unknowns, particles outside the group keep
+   their temperature; walls enter via the conductances accumulated by
+   fix wall/gran; radiation is non-linear and not part of the network
+   the system is solved with a Jacobi-preconditioned conjugate gradient
+   method, the matrix is applied contact by contact
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::solve_steady_state()
+{
+  int i,j;
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  int *mask = atom->mask;
+  int newton_pair = force->newton_pair;
+
+  updatePtrs();
+
+  if(nmax_steady_ < atom->nmax)
+  {
+    nmax_steady_ = atom->nmax;
+    memory->grow(diag_,nmax_steady_,"heat/gran:diag_");
+    memory->grow(rhs_,nmax_steady_,"heat/gran:rhs_");
+    memory->grow(sol_,nmax_steady_,"heat/gran:sol_");
+    memory->grow(res_,nmax_steady_,"heat/gran:res_");
+    memory->grow(zvec_,nmax_steady_,"heat/gran:zvec_");
+    memory->grow(dir_,nmax_steady_,"heat/gran:dir_");
+    memory->grow(aprod_,nmax_steady_,"heat/gran:aprod_");
+  }
+
+  double *wall_hc = fix_wall_conductance_->vector_atom;
+  double *wall_hct = fix_wall_conductance_temp_->vector_atom;
+
+  // assemble diagonal and right-hand side
+  // contacts with particles outside the group act as fixed temperatures
+
+  double anchor = 0.;
+
+  for(i = 0; i < nall; i++)
+    diag_[i] = rhs_[i] = 0.;
+
+  for(int n = 0; n < nnet_; n++)
+  {
+    i = net_i_[n];
+    j = net_j_[n];
+    const double hc = net_hc_[n];
+
+    diag_[i] += hc;
+    if(!(mask[j] & groupbit))
+    {
+      rhs_[i] += hc*Temp[j];
+      anchor += hc;
+    }
+    if(newton_pair || j < nlocal)
+    {
+      diag_[j] += hc;
+      if(!(mask[i] & groupbit))
+      {
+        rhs_[j] += hc*Temp[i];
+        anchor += hc;
+      }
+    }
+  }
+
+  if(newton_pair)
+  {
+    comm_vec_[0] = diag_;
+    comm_vec_[1] = rhs_;
+    comm_nvec_ = 2;
+    comm->reverse_comm_fix(this);
+    comm_nvec_ = 0;
+  }
+
+  for(i = 0; i < nlocal; i++)
+  {
+    if(!(mask[i] & groupbit)) continue;
+
+    diag_[i] += wall_hc[i];
+    rhs_[i] += wall_hct[i] + heatSource[i];
+    anchor += wall_hc[i];
+
+    // particles without any conductance keep their temperature
+    if(diag_[i] <= 0.)
+    {
+      diag_[i] = 1.;
+      rhs_[i] = Temp[i];
+    }
+  }
+
+  MPI_Sum_Scalar(anchor,world);
+  if(anchor <= 0.)
+    error->fix_error(FLERR,this,"steady-state solve requires particles in contact with a wall "
+                               "with temperature or with particles outside the fix group");
+
+  // initial guess is the current temperature
+  // vectors are zero for particles that are not unknowns
+
+  for(i = 0; i < nlocal; i++)
+    sol_[i] = (mask[i] & groupbit) ? Temp[i] : 0.;
+
+  apply_network(sol_,aprod_);
+
+  for(i = 0; i < nlocal; i++)
+  {
+    if(mask[i] & groupbit)
+    {
+      res_[i] = rhs_[i] - aprod_[i];
+      zvec_[i] = res_[i]/diag_[i];
+    }
+    else
+      res_[i] = zvec_[i] = 0.;
+    dir_[i] = zvec_[i];
+  }
+
+  double bnorm = sqrt(dot_unknowns(rhs_,rhs_));
+  if(bnorm == 0.) bnorm = 1.;
+  double rz = dot_unknowns(res_,zvec_);
+  double rnorm = sqrt(dot_unknowns(res_,res_));
+  int iter = 0;
+
+  while(rnorm > steady_tolerance_*bnorm && iter < steady_max_iter_)
+  {
+    apply_network(dir_,aprod_);
+
+    const double pq = dot_unknowns(dir_,aprod_);
+    if(pq <= 0.) break;
+    const double alpha = rz/pq;
+
+    for(i = 0; i < nlocal; i++)
+    {
+      if(!(mask[i] & groupbit)) continue;
+      sol_[i] += alpha*dir_[i];
+      res_[i] -= alpha*aprod_[i];
+      zvec_[i] = res_[i]/diag_[i];
+    }
+
+    const double rz_new = dot_unknowns(res_,zvec_);
+    const double beta = rz_new/rz;
+    rz = rz_new;
+
+    for(i = 0; i < nlocal; i++)
+      if(mask[i] & groupbit)
+        dir_[i] = zvec_[i] + beta*dir_[i];
+
+    rnorm = sqrt(dot_unknowns(res_,res_));
+    iter++;
+  }
+
+  // apply solution
+
+  // with the fused integrator, the fluxes of this step would be applied
+  // on top of the steady temperature in the next step
+  for(i = 0; i < nlocal; i++)
+    if(mask[i] & groupbit)
+    {
+      Temp[i] = sol_[i];
+      if(INTEGRATOR_STE != integrator_)
+        heatFlux[i] = 0.;
+    }
+  fix_temp->do_forward_comm();
+
+  // ghosts do not hold the temperatures last sent by the compressed mode
+  last_temp_refresh_ = -1;
+
+  if(comm->me == 0)
+  {
+    if(rnorm > steady_tolerance_*bnorm)
+      error->warning(FLERR,"Fix heat/gran/conduction: steady-state solve did not converge, "
+                           "check for particle clusters without thermal contact to a boundary or increase 'steady_max_iter'");
+    if(screen)
+      fprintf(screen,"Fix heat/gran/conduction: steady-state solve, %d iterations, relative residual %g\n",iter,rnorm/bnorm);
+    if(logfile)
+      fprintf(logfile,"Fix heat/gran/conduction: steady-state solve, %d iterations, relative residual %g\n",iter,rnorm/bnorm);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   out = A in for the unknowns, A is the conductance matrix
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::apply_network(double *in, double *out)
+{
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  int *mask = atom->mask;
+  int newton_pair = force->newton_pair;
+
+  // ghost values of in
+
+  comm_vec_[0] = in;
+  comm_nvec_ = 1;
+  comm->forward_comm_fix(this);
+
+  for(int i = 0; i < nlocal; i++)
+    out[i] = (mask[i] & groupbit) ? diag_[i]*in[i] : 0.;
+  for(int i = nlocal; i < nall; i++)
+    out[i] = 0.;
+
+  for(int n = 0; n < nnet_; n++)
+  {
+    const int i = net_i_[n];
+    const int j = net_j_[n];
+    const double hc = net_hc_[n];
+
+    out[i] -= hc*in[j];
+    if(newton_pair || j < nlocal)
+      out[j] -= hc*in[i];
+  }
+
+  if(newton_pair)
+  {
+    comm_vec_[0] = out;
+    comm->reverse_comm_fix(this);
+  }
+  comm_nvec_ = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+double FixHeatGranCond::dot_unknowns(double *a, double *b)
+{
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+  double dot = 0.;
+
+  for(int i = 0; i < nlocal; i++)
+    if(mask[i] & groupbit)
+      dot += a[i]*b[i];
+
+  MPI_Sum_Scalar(dot,world);
+  return dot;
+}
+
+/* ----------------------------------------------------------------------
+   forward communication of a solver vector
+------------------------------------------------------------------------- */
+
+int FixHeatGranCond::pack_comm(int n, int *list, double *buf, int pbc_flag, int *pbc)
+{
+  int i,j,m;
+
+  m = 0;
+
+  // owner rank and index for the ghost plan
+  if(comm_owner_)
+  {
+    for (i = 0; i < n; i++)
+    {
+      j = list[i];
+      buf[m++] = ghost_owner_[j];
+      buf[m++] = ghost_index_[j];
+    }
+    return 2;
+  }
+
+  // position and temperature for the ghost records of the packed state
+  if(comm_state_)
+  {
+    double **x = atom->x;
+    double dx = 0., dy = 0., dz = 0.;
+    if(pbc_flag)
+    {
+      if(domain->triclinic == 0)
+      {
+        dx = pbc[0]*domain->xprd;
+        dy = pbc[1]*domain->yprd;
+        dz = pbc[2]*domain->zprd;
+      }
+      else
+      {
+        dx = pbc[0]*domain->xprd + pbc[5]*domain->xy + pbc[4]*domain->xz;
+        dy = pbc[1]*domain->yprd + pbc[3]*domain->yz;
+        dz = pbc[2]*domain->zprd;
+      }
+    }
+    for (i = 0; i < n; i++)
+    {
+      j = list[i];
+      buf[m++] = x[j][0] + dx;
+      buf[m++] = x[j][1] + dy;
+      buf[m++] = x[j][2] + dz;
+      buf[m++] = Temp[j];
+    }
+    return 4;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    j = list[i];
+    buf[m++] = comm_vec_[0][j];
+  }
+  return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGranCond::unpack_comm(int n, int first, double *buf)
+{
+  int i,m,last;
+
+  m = 0;
+  last = first + n;
+
+  if(comm_owner_)
+  {
+    for (i = first; i < last; i++)
+    {
+      ghost_owner_[i] = buf[m++];
+      ghost_index_[i] = buf[m++];
+    }
+    return;
+  }
+
+  if(comm_state_)
+  {
+    for (i = first; i < last; i++)
+    {
+      ThermalState &si = thermal_state_[i];
+      si.x[0] = buf[m++];
+      si.x[1] = buf[m++];
+      si.x[2] = buf[m++];
+      si.Temp = buf[m++];
+      Temp[i] = si.Temp;
+    }
+    return;
+  }
+
+  for (i = first; i < last; i++)
+    comm_vec_[0][i] = buf[m++];
+}
+
+/* ----------------------------------------------------------------------
+   contact recording
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::add_record_pair(int i,int j,double overlap)
+{
+  if(nrec_pair_ == maxrec_pair_)
+  {
+    maxrec_pair_ += DELTA_RECORD;
+    memory->grow(rec_pair_,maxrec_pair_,"heat/gran:rec_pair_");
+  }
+  RecordPair &rec = rec_pair_[nrec_pair_];
+  rec.tag_i = atom->tag[i];
+  rec.tag_j = atom->tag[j];
+  rec.overlap = overlap;
+  nrec_pair_++;
+}
+
+/* ----------------------------------------------------------------------
+   called by fix wall/gran for each wall contact of a record step
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::record_wall_contact(int ip,int wall_type,double deltan,double area,double temp_wall)
+{
+  if(nrec_wall_ == maxrec_wall_)
+  {
+    maxrec_wall_ += DELTA_RECORD;
+    memory->grow(rec_wall_,maxrec_wall_,"heat/gran:rec_wall_");
+  }
+  RecordWall &rec = rec_wall_[nrec_wall_];
+  rec.tag = atom->tag[ip];
+  rec.wall_type = wall_type;
+  rec.deltan = deltan;
+  rec.area = area;
+  rec.temp = temp_wall;
+  nrec_wall_++;
+}
+
+/* ----------------------------------------------------------------------
+   write the records of all procs, proc 0 receives them one proc
+   at a time, so only per-proc counts are needed
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::write_record(const void *sendbuf,int nsend,int size)
+{
+  MPI_Datatype rectype;
+  MPI_Type_contiguous(size,MPI_BYTE,&rectype);
+  MPI_Type_commit(&rectype);
+
+  if(comm->me == 0)
+  {
+    fwrite(sendbuf,size,nsend,record_fp_);
+
+    for(int iproc = 1; iproc < comm->nprocs; iproc++)
+    {
+      int nrecv;
+      MPI_Status status;
+      MPI_Recv(&nrecv,1,MPI_INT,iproc,0,world,&status);
+      if(nrecv > maxrec_recv_)
+      {
+        maxrec_recv_ = nrecv;
+        memory->sfree(rec_recv_);
+        rec_recv_ = static_cast<char*>(memory->smalloc(static_cast<bigint>(maxrec_recv_)*size,"heat/gran:rec_recv_"));
+      }
+      MPI_Recv(rec_recv_,nrecv,rectype,iproc,0,world,&status);
+      fwrite(rec_recv_,size,nrecv,record_fp_);
+    }
+  }
+  else
+  {
+    MPI_Send(&nsend,1,MPI_INT,0,0,world);
+    MPI_Send(const_cast<void*>(sendbuf),nsend,rectype,0,0,world);
+  }
+
+  MPI_Type_free(&rectype);
+}
+
+/* ----------------------------------------------------------------------
+   write the contact network of this step
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::write_contact_frame()
+{
+  int nlocal = atom->nlocal;
+  int *tag = atom->tag;
+  double **x = atom->x;
+
+  if(nlocal > maxrec_atom_)
+  {
+    maxrec_atom_ = atom->nmax;
+    memory->grow(rec_atom_,maxrec_atom_,"heat/gran:rec_atom_");
+  }
+  for(int i = 0; i < nlocal; i++)
+  {
+    rec_atom_[i].tag = tag[i];
+    rec_atom_[i].unused = 0;
+    rec_atom_[i].x[0] = x[i][0];
+    rec_atom_[i].x[1] = x[i][1];
+    rec_atom_[i].x[2] = x[i][2];
+  }
+
+  bigint nlocal_rec[3] = {nlocal, nrec_pair_, nrec_wall_};
+  bigint nall_rec[3];
+  MPI_Reduce(nlocal_rec,nall_rec,3,MPI_LMP_BIGINT,MPI_SUM,0,world);
+
+  if(comm->me == 0)
+  {
+    ContactLogFrame frame;
+    frame.step = update->ntimestep;
+    frame.natoms = nall_rec[0];
+    frame.npairs = nall_rec[1];
+    frame.nwalls = nall_rec[2];
+    fwrite(&frame,sizeof(ContactLogFrame),1,record_fp_);
+  }
+
+  write_record(rec_atom_,nlocal,sizeof(RecordAtom));
+  write_record(rec_pair_,nrec_pair_,sizeof(RecordPair));
+  write_record(rec_wall_,nrec_wall_,sizeof(RecordWall));
+  if(comm->me == 0)
+    fflush(record_fp_);
+}
+
+/* ----------------------------------------------------------------------
+   map the contact log and index its frames
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::open_replay()
+{
+  int fd = open(replay_file_,O_RDONLY);
+  if(fd < 0)
+    error->one(FLERR,"Fix heat/gran/conduction: cannot open file for 'replay_contacts'");
+
+  struct stat st;
+  if(fstat(fd,&st) < 0 || static_cast<size_t>(st.st_size) < 8)
+    error->one(FLERR,"Fix heat/gran/conduction: file for 'replay_contacts' is not a contact log");
+  replay_size_ = st.st_size;
+
+  void *map = mmap(NULL,replay_size_,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if(map == MAP_FAILED)
+    error->one(FLERR,"Fix heat/gran/conduction: cannot map file for 'replay_contacts'");
+  replay_map_ = static_cast<char*>(map);
+
+  if(memcmp(replay_map_,CONTACT_LOG_MAGIC,8) != 0)
+    error->one(FLERR,"Fix heat/gran/conduction: file for 'replay_contacts' is not a contact log");
+
+  replay_offset_.clear();
+  replay_step_.clear();
+
+  size_t offset = 8;
+  while(offset + sizeof(ContactLogFrame) <= replay_size_)
+  {
+    const ContactLogFrame *frame = reinterpret_cast<const ContactLogFrame*>(replay_map_+offset);
+    const size_t next = offset + sizeof(ContactLogFrame) + frame->natoms*sizeof(RecordAtom) +
+                        frame->npairs*sizeof(RecordPair) + frame->nwalls*sizeof(RecordWall);
+
+    // incomplete last frame of an aborted recording is ignored
+    if(next > replay_size_) break;
+
+    replay_offset_.push_back(offset);
+    replay_step_.push_back(frame->step);
+    offset = next;
+  }
+
+  if(replay_offset_.empty())
+    error->one(FLERR,"Fix heat/gran/conduction: file for 'replay_contacts' contains no frames");
+}
+
+/* ----------------------------------------------------------------------
+   heat transfer from the recorded contact network
+   the latest frame at or before the current step is used
+   each contact is evaluated by the proc that owns one of its particles,
+   so no reverse communication is needed
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::replay_eval()
+{
+  int nlocal = atom->nlocal;
+  int *mask = atom->mask;
+  int *type = atom->type;
+  double *radius = atom->radius;
+  double **x = atom->x;
+  int i,j;
+
+  cull_contacts_ = full_sweep_ = cull_track_ = false;
+  fill_flux_cache_ = false;
+  span_weight_ = 1.;
+  assemble_network_ = false;
+  culled_heat_ = total_heat_ = 0.;
+
+  updatePtrs();
+
+  if(store_contact_data_)
+  {
+    fix_conduction_contact_area_->set_all(0.);
+    fix_n_conduction_contacts_->set_all(0.);
+  }
+
+  const int nframes = replay_offset_.size();
+  if(replay_frame_ < 0) replay_frame_ = 0;
+  while(replay_frame_+1 < nframes && replay_step_[replay_frame_+1] <= update->ntimestep)
+    replay_frame_++;
+
+  const ContactLogFrame *frame = reinterpret_cast<const ContactLogFrame*>(replay_map_+replay_offset_[replay_frame_]);
+  const RecordAtom *rec_atom = reinterpret_cast<const RecordAtom*>(frame+1);
+  const RecordPair *rec_pair = reinterpret_cast<const RecordPair*>(rec_atom+frame->natoms);
+  const RecordWall *rec_wall = reinterpret_cast<const RecordWall*>(rec_pair+frame->npairs);
+
+  // wall contacts of the log would be counted twice if
+  // a fix wall/gran still transfers heat itself
+  if(replay_wall_check_)
+  {
+    replay_walls_ = true;
+    for(int ifix = 0; ifix < modify->nfix; ifix++)
+      if(strncmp(modify->fix[ifix]->style,"wall/gran",9) == 0 &&
+         static_cast<FixWallGran*>(modify->fix[ifix])->heattransfer_flag())
+        replay_walls_ = false;
+    if(!replay_walls_ && frame->nwalls > 0 && comm->me == 0)
+      error->warning(FLERR,"Fix heat/gran/conduction: wall heat transfer is computed by fix wall/gran, "
+                           "recorded wall contacts are not replayed");
+    replay_wall_check_ = false;
+  }
+
+  // positions of owned particles are set when a new frame is reached,
+  // particles migrate with the regular re-neighboring
+
+  if(replay_frame_ != replay_applied_frame_)
+  {
+    for(bigint n = 0; n < frame->natoms; n++)
+    {
+      i = atom->map(rec_atom[n].tag);
+      if(i < 0 || i >= nlocal) continue;
+      x[i][0] = rec_atom[n].x[0];
+      x[i][1] = rec_atom[n].x[1];
+      x[i][2] = rec_atom[n].x[2];
+    }
+    replay_applied_frame_ = replay_frame_;
+  }
+
+  radiation_eval(0);
+
+  // particle-particle contacts, evaluated with the batched kernel
+  // the owned particle is i, flux is added to j only if it is owned as well
+
+  nbatch_ = 0;
+  for(bigint n = 0; n < frame->npairs; n++)
+  {
+    i = atom->map(rec_pair[n].tag_i);
+    j = atom->map(rec_pair[n].tag_j);
+    if(i < 0 || i >= nlocal) std::swap(i,j);
+    if(i < 0 || i >= nlocal) continue;
+
+    // partner beyond the ghost cutoff, counted and reported in post_run()
+    if(j < 0)
+    {
+      replay_missing_++;
+      continue;
+    }
+
+    if (!(mask[i] & groupbit) && !(mask[j] & groupbit)) continue;
+    if(lumped_bodies_ && same_body(i,j)) continue;
+
+    const double radi = radius[i];
+    const double radj = radius[j];
+    const double r = radi + radj - rec_pair[n].overlap;
+
+    batch_i_[nbatch_] = i;
+    batch_j_[nbatch_] = j;
+    batch_delx_[nbatch_] = x[i][0] - x[j][0];
+    batch_dely_[nbatch_] = x[i][1] - x[j][1];
+    batch_delz_[nbatch_] = x[i][2] - x[j][2];
+    batch_rsq_[nbatch_] = r*r;
+    batch_radi_[nbatch_] = radi;
+    batch_radj_[nbatch_] = radj;
+    batch_Ti_[nbatch_] = Temp[i];
+    batch_Tj_[nbatch_] = Temp[j];
+    batch_tcoi_[nbatch_] = conductivity_[type[i]-1];
+    batch_tcoj_[nbatch_] = conductivity_[type[j]-1];
+    batch_weight_[nbatch_] = 1.;
+
+    if(++nbatch_ == CONDUCTION_BATCH_SIZE)
+    {
+      replay_batch_eval(nlocal);
+      nbatch_ = 0;
+    }
+  }
+
+  if(nbatch_ > 0)
+    replay_batch_eval(nlocal);
+
+  // wall contacts
+
+  const int max_type = atom->get_properties()->max_type();
+  const bigint nwalls = replay_walls_ ? frame->nwalls : 0;
+  for(bigint n = 0; n < nwalls; n++)
+  {
+    i = atom->map(rec_wall[n].tag);
+    if(i < 0 || i >= nlocal || !(mask[i] & groupbit)) continue;
+
+    const int wall_type = rec_wall[n].wall_type;
+    if(wall_type < 1 || wall_type > max_type)
+      error->one(FLERR,"Fix heat/gran/conduction: wall type of replayed contact does not exist");
+
+    const double tcop = conductivity_[type[i]-1];
+    const double tcowall = conductivity_[wall_type-1];
+    const double hc = (tcop < SMALL_FIX_HEAT_GRAN || tcowall < SMALL_FIX_HEAT_GRAN) ?
+                      0. : 4.*tcop*tcowall/(tcop+tcowall)*sqrt(rec_wall[n].area);
+
+    heatFlux[i] += (rec_wall[n].temp-Temp[i])*hc;
+    if(store_contact_data_)
+    {
+      wall_heattransfer_coeff_[i] = hc;
+      wall_temp_[i] = rec_wall[n].temp;
+    }
+  }
+
+  if(store_contact_data_)
+  for(i = 0; i < nlocal; i++)
+  {
+     if(n_conduction_contacts_[i] > 0.5)
+        conduction_contact_area_[i] /= n_conduction_contacts_[i];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   evaluate a batch of replayed contacts, fluxes are only added to owned
+   particles
+------------------------------------------------------------------------- */
+
+void FixHeatGranCond::replay_batch_eval(int nlocal)
+{
+  if(CONDUCTION_CONTACT_AREA_OVERLAP == area_calculation_mode_)
+    conduction_batch_eval<CONDUCTION_CONTACT_AREA_OVERLAP>(0,0,nlocal);
+  else if(CONDUCTION_CONTACT_AREA_CONSTANT == area_calculation_mode_)
+    conduction_batch_eval<CONDUCTION_CONTACT_AREA_CONSTANT>(0,0,nlocal);
+  else
+    conduction_batch_eval<CONDUCTION_CONTACT_AREA_PROJECTION>(0,0,nlocal);
+}
+
+/* ----------------------------------------------------------------------
+   packed reverse communication
+   heatFlux and - if active - directionalHeatFlux and contact data
+   are sent together instead of one message round per property
+------------------------------------------------------------------------- */
+
+int FixHeatGranCond::pack_reverse_comm(int n, int first, double *buf)
+{
+  int i,k,m,last;
+
+  m = 0;
+  last = first + n;
+
+  // solver vectors of the steady-state mode
+  if(comm_nvec_ > 0)
+  {
+    for (i = first; i < last; i++)
+      for (k = 0; k < comm_nvec_; k++)
+        buf[m++] = comm_vec_[k][i];
+    return comm_nvec_;
+  }
+
+  for (i = first; i < last; i++)
+    m += pack_flux(i,&buf[m]);
+  return flux_comm_size();
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixHeatGranCond::unpack_reverse_comm(int n, int *list, double *buf)
+{
+  int i,j,k,m;
+
+  m = 0;
+
+  if(comm_nvec_ > 0)
+  {
+    for (i = 0; i < n; i++)
+    {
+      j = list[i];
+      for (k = 0; k < comm_nvec_; k++)
+        comm_vec_[k][j] += buf[m++];
+    }
+    return;
+  }
+
+  for (i = 0; i < n; i++)
+    m += unpack_flux(list[i],&buf[m]);
+}
+
+/* ----------------------------------------------------------------------
+   thermal fields of one atom that ghosts send to their owner
+------------------------------------------------------------------------- */
+
+int FixHeatGranCond::flux_comm_size()
+{
+  return 1 + (directional_flux_ ? 3 : 0) + (store_contact_data_ ? 2 : 0) + (accumulate_conductance_ ? 1 : 0);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixHeatGranCond::pack_flux(int i, double *buf)
+{
+  int m = 0;
+
+  buf[m++] = heatFlux[i];
+  if(directional_flux_)
+  {
+    buf[m++] = directionalHeatFlux[i][0];
+    buf[m++] = directionalHeatFlux[i][1];
+    buf[m++] = directionalHeatFlux[i][2];
+  }
+  if(store_contact_data_)
+  {
+    buf[m++] = conduction_contact_area_[i];
+    buf[m++] = n_conduction_contacts_[i];
+  }
+  if(accumulate_conductance_)
+    buf[m++] = conductance_[i];
+  return m;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixHeatGranCond::unpack_flux(int i, double *buf)
+{
+  int m = 0;
+
+  heatFlux[i] += buf[m++];
+  if(directional_flux_)
+  {
+    directionalHeatFlux[i][0] += buf[m++];
+    directionalHeatFlux[i][1] += buf[m++];
+    directionalHeatFlux[i][2] += buf[m++];
+  }
+  if(store_contact_data_)
+  {
+    conduction_contact_area_[i] += buf[m++];
+    n_conduction_contacts_[i] += buf[m++];
   }
+  if(accumulate_conductance_)
+    conductance_[i] += buf[m++];
+  return m;
 }
 
 /* ----------------------------------------------------------------------
@@ -666,6 +3052,8 @@ void FixHeatGranCond::register_compute_pair_local(ComputePairGranLocal *ptr)
    
    if(cpl != NULL)
       error->all(FLERR,"Fix heat/gran/conduction allows only one compute of type pair/local");
+   if(replay_)
+      error->all(FLERR,"Fix heat/gran/conduction can not be used with compute pair/local in 'replay_contacts' mode");
    cpl = ptr;
 }
 
@@ -50,6 +50,7 @@ FixStyle(heat/gran,FixHeatGranCond)
 #define LMP_FIX_HEATGRAN_CONDUCTION_H
 
 #include "fix_heat_gran.h"
+#include <vector>
 
 namespace LAMMPS_NS {
 
@@ -64,6 +65,9 @@ namespace LAMMPS_NS {
     void init();
     virtual void pre_force(int vflag);
     virtual void post_force(int vflag);
+    virtual void final_integrate();
+    virtual void end_of_step();
+    virtual void post_run();
 
     virtual void cpl_evaluate(class ComputePairGranLocal *);
     void register_compute_pair_local(ComputePairGranLocal *);
@@ -71,10 +75,28 @@ namespace LAMMPS_NS {
 
     virtual void updatePtrs();
 
+    // contact recording
+    virtual bool records_contacts() const
+    { return record_frame_; }
+    virtual void record_wall_contact(int,int,double,double,double);
+
+    // packed reverse communication of all thermal per-atom fields
+    virtual int pack_reverse_comm(int, int, double *);
+    virtual void unpack_reverse_comm(int, int *, double *);
+
+    // forward communication of solver vectors
+    virtual int pack_comm(int, int *, double *, int, int *);
+    virtual void unpack_comm(int, int, double *);
+
   protected:
     int iarg_;
 
     template <int,int> void post_force_eval(int,int);
+    void radiation_eval(int);
+    template <int,int> void conduction_contacts(int,int);
+    template <int,int,int> void conduction_eval(int,int);
+    template <int> void conduction_batch_eval(int,int,int);
+    int select_batch_kernel();
 
     class FixPropertyGlobal* fix_conductivity_;
     double *conductivity_;
@@ -94,9 +116,182 @@ namespace LAMMPS_NS {
 
     double fixed_contact_area_;
 
+    // coarsegraining ratio and resulting scaling
+    double cg_;
+    double cg_contact_area_;
+    double cg_view_factor_;
+
     // for heat transfer area correction
     int area_correction_flag_;
     double const* const* deltan_ratio_;
+
+    // contacts gathered for the batched conduction kernel
+    static const int CONDUCTION_BATCH_SIZE = 128;
+    // the dense part runs in an AVX2 or AVX-512 kernel if the CPU has it
+    int nbatch_;
+    int batch_simd_;
+    int *batch_i_, *batch_j_;
+    double *batch_delx_, *batch_dely_, *batch_delz_;
+    double *batch_rsq_, *batch_radi_, *batch_radj_;
+    double *batch_Ti_, *batch_Tj_;
+    double *batch_tcoi_, *batch_tcoj_;
+    double *batch_ratio_;
+    double *batch_area_, *batch_hc_, *batch_flux_;
+    double *batch_weight_;
+
+    // culling of contacts close to thermal equilibrium
+    // each neighbor list entry stores the thermal clock (steps covered by
+    // evaluations) up to which its heat transfer was applied
+    double equilibrium_tolerance_;
+    int full_sweep_every_;
+    bool cull_contacts_, full_sweep_, cull_track_;
+    double culled_heat_, total_heat_;
+    bool culling_warned_;
+    double cull_clock_;
+    bigint cull_build_;
+    int maxcull_i_, maxcull_;
+    int *cull_first_;
+    double *cull_stamp_;
+    void build_cull_stamps();
+    void check_equilibrium_culling();
+
+    // per-contact fluxes of output steps, streamed to compute pair/gran/local
+    bool cache_contact_flux_;
+    bool fill_flux_cache_;
+    bigint flux_cache_step_;
+    int ncache_, maxcache_;
+    int *cache_i_, *cache_j_;
+    double *cache_flux_;
+    void add_to_flux_cache(int,int,double);
+
+    // split-phase mode: contacts with ghost atoms are evaluated first, their
+    // partial fluxes are sent to the owners with non-blocking messages while
+    // the contacts between owned atoms are evaluated
+    // the ghost plan maps each ghost to its owner rank and owner index, it is
+    // rebuilt with the neighbor list; ghosts are grouped by owner rank,
+    // send_* are ghosts of this rank, recv_* owned atoms that are ghosts elsewhere
+    bool split_phase_;
+    bool comm_owner_;
+    bigint ghost_plan_build_;
+    int nmax_ghost_plan_;
+    double *ghost_owner_, *ghost_index_;
+    std::vector<int> plan_send_proc_, plan_send_first_, plan_send_ghost_;
+    std::vector<int> plan_recv_proc_, plan_recv_first_, plan_recv_owned_;
+    std::vector<int> plan_self_ghost_, plan_self_owned_;
+    std::vector<double> plan_send_buf_, plan_recv_buf_;
+    std::vector<MPI_Request> plan_request_;
+    std::vector<MPI_Status> plan_status_;
+    void build_ghost_plan();
+    template <int,int> void split_phase_contacts(int);
+    int flux_comm_size();
+    int pack_flux(int,double *);
+    int unpack_flux(int,double *);
+
+    // compressed forward communication of ghost temperatures on the ghost plan
+    // owners send index/value pairs of the entries that changed by more than a
+    // relative tolerance since they were last sent; all entries are sent after
+    // a plan rebuild and every temp_comm_refresh_ steps
+    bool temp_comm_compress_;
+    double temp_comm_tol_;
+    int temp_comm_refresh_;
+    bigint last_temp_refresh_;
+    std::vector<double> plan_temp_sent_;
+    std::vector<double> temp_send_buf_, temp_recv_buf_;
+    virtual void forward_temperature();
+
+    // steady-state mode: conductance network of the current step
+    // is solved for the steady temperature field
+    int steady_every_;
+    double steady_tolerance_;
+    int steady_max_iter_;
+    bool assemble_network_;
+    int nnet_, maxnet_;
+    int *net_i_, *net_j_;
+    double *net_hc_;
+    class FixPropertyAtom* fix_wall_conductance_;
+    class FixPropertyAtom* fix_wall_conductance_temp_;
+    int nmax_steady_;
+    double *diag_, *rhs_, *sol_, *res_, *zvec_, *dir_, *aprod_;
+    double *comm_vec_[2];
+    int comm_nvec_;
+    void add_to_network(int,int,double);
+    void solve_steady_state();
+    void apply_network(double *, double *);
+    double dot_unknowns(double *, double *);
+
+    // record of the contact network, written every record_every_ steps
+    // frame: atoms (tag,x), pairs (tag_i,tag_j,overlap) and
+    // wall contacts (tag,wall type,deltan,contact area,wall temperature)
+    struct RecordAtom { int tag, unused; double x[3]; };
+    struct RecordPair { int tag_i, tag_j; double overlap; };
+    struct RecordWall { int tag, wall_type; double deltan, area, temp; };
+    char *record_file_;
+    int record_every_;
+    bool record_frame_;
+    FILE *record_fp_;
+    int nrec_pair_, maxrec_pair_;
+    int nrec_wall_, maxrec_wall_;
+    int maxrec_atom_;
+    RecordAtom *rec_atom_;
+    RecordPair *rec_pair_;
+    RecordWall *rec_wall_;
+    int maxrec_recv_;
+    char *rec_recv_;
+    void add_record_pair(int,int,double);
+    void write_contact_frame();
+    void write_record(const void *,int,int);
+
+    // replay of a recorded contact network, the log is memory-mapped
+    // recorded wall contacts are skipped if a fix wall/gran transfers heat
+    char *replay_file_;
+    char *replay_map_;
+    size_t replay_size_;
+    std::vector<size_t> replay_offset_;
+    std::vector<bigint> replay_step_;
+    int replay_frame_, replay_applied_frame_;
+    bigint replay_missing_;
+    bool replay_walls_, replay_wall_check_;
+    void open_replay();
+    void replay_eval();
+    void replay_batch_eval(int);
+
+    // thermal timestep control, see FixHeatGran
+    double span_weight_;
+    bool thermal_eval_step_;
+    bool subcycle_pending_;
+    int nmax_subcycle_;
+    double *sub_temp_, *sub_flux_, *sub_flux_avg_;
+    void grow_subcycle();
+    template <int,int> void thermal_subcycle();
+
+    // packed per-atom record of the data read for neighbors
+    // in the conduction loop, one cache line aligned 64 byte record per atom
+    // the records are rebuilt after reneighboring, in between owned records
+    // are refreshed and ghost records are updated by forward communication
+    struct ThermalState
+    {
+      double x[3];
+      double radius;
+      double Temp;
+      double cond;
+      int mask;
+      int type;
+      double unused;
+    };
+    bool packed_state_;
+    bool comm_state_;
+    bigint state_build_;
+    int nmax_thermal_state_;
+    char *thermal_state_mem_;
+    ThermalState *thermal_state_;
+    void pack_thermal_state();
+
+    // neighbor pairs involving the group
+    bool group_sublist_;
+    bigint sublist_build_;
+    int nsub_i_, maxsub_i_, maxsub_j_;
+    int *sub_ii_, *sub_first_, *sub_jj_;
+    void build_group_sublist();
   };
 
 }
@@ -56,6 +56,7 @@
 #include "fix_rigid.h"
 #include "fix_mesh.h"
 #include "fix_contact_history_mesh.h"
+#include "contact_history_mesh_hash.h"
 #include "modify.h"
 #include "respa.h"
 #include "memory.h"
@@ -72,8 +73,10 @@
 #include "primitive_wall_definitions.h"
 #include "mpi_liggghts.h"
 #include "neighbor.h"
+#include "output.h"
 #include "contact_interface.h"
 #include "fix_property_global.h"
+#include "fix_heat_gran.h"
 #include "domain_wedge.h"
 #include <vector>
 
@@ -83,6 +86,9 @@
 
 #define STEFAN_BOLTZMANN 5.67e-8
 
+// primitives of one fix are tracked in an int bitmask
+#define MAX_PRIMITIVE_WALLS 31
+
 using namespace LAMMPS_NS;
 using namespace FixConst;
 using namespace LAMMPS_NS::PRIMITIVE_WALL_DEFINITIONS;
@@ -122,8 +128,7 @@ FixWallGran::FixWallGran(LAMMPS *lmp, int narg, char **arg) :
     r0_ = 0.;
 
     shear_ = 0;
-    shearDim_ = shearAxis_ = -1;
-    vectorZeroize3D(shearAxisVec_);
+    shearDim_ = -1;
 
     atom_type_wall_ = 1; // will be overwritten during execution, but other fixes require a value here
 
@@ -136,10 +141,24 @@ FixWallGran::FixWallGran(LAMMPS *lmp, int narg, char **arg) :
     heattransfer_flag_ = false;
 
     FixMesh_list_ = NULL;
+    nPrimitiveWalls_ = 0;
+    primitiveWalls_ = NULL;
     primitiveWall_ = NULL;
     fix_history_primitive_ = NULL;
+    nPrimitiveNeigh_ = maxPrimitiveNeigh_ = 0;
+    primitiveNeigh_ = primitiveNeighMask_ = NULL;
+    nmaxPrimitiveMask_ = 0;
+    primitiveMask_ = NULL;
+    maxPrimitiveContact_ = 0;
+    primitiveContactIdx_ = primitiveContactWall_ = NULL;
+    primitiveContactRad_ = primitiveContactDeltan_ = primitiveContactDelta_ = NULL;
 
     rebuildPrimitiveNeighlist_ = false;
+    incrementalPrimitiveNeighlist_ = false;
+    ompResolve_ = false;
+    ompResolveCheckStep_ = -1;
+    particleMajor_ = false;
+    hashContactHistory_ = false;
 
     addflag_ = 0;
     cwl_ = NULL;
@@ -194,11 +213,17 @@ FixWallGran::FixWallGran(LAMMPS *lmp, int narg, char **arg) :
            if (meshwall_ == 1)
              error->fix_error(FLERR,this,"'mesh' and 'primitive' are incompatible, choose either of them");
 
+           if (nPrimitiveWalls_ == MAX_PRIMITIVE_WALLS)
+             error->fix_error(FLERR,this,"too many primitive walls");
+
            if (strcmp(arg[iarg_++],"type"))
              error->fix_error(FLERR,this,"expecting keyword 'type'");
-           atom_type_wall_ = force->inumeric(FLERR,arg[iarg_++]);
-           if (atom_type_wall_ < 1 || atom_type_wall_ > atom->ntypes)
+           const int type = force->inumeric(FLERR,arg[iarg_++]);
+           if (type < 1 || type > atom->ntypes)
              error->fix_error(FLERR,this,"1 <= type <= max type as defined in create_box'");
+           if (nPrimitiveWalls_ > 0 && type != atom_type_wall_)
+             error->fix_error(FLERR,this,"all primitive walls of one fix need the same type");
+           atom_type_wall_ = type;
 
            char *wallstyle = arg[iarg_++];
            int nPrimitiveArgs = PRIMITIVE_WALL_DEFINITIONS::numArgsPrimitiveWall(wallstyle);
@@ -219,7 +244,13 @@ FixWallGran::FixWallGran(LAMMPS *lmp, int narg, char **arg) :
              
              if(strcmp(wallstyle,PRIMITIVE_WALL_DEFINITIONS::wallString[w]) == 0)
              {
-               primitiveWall_ = new PrimitiveWall(lmp,(PRIMITIVE_WALL_DEFINITIONS::WallType)w,nPrimitiveArgs,argVec);
+               PrimitiveWall **walls = new PrimitiveWall*[nPrimitiveWalls_+1];
+               for(int p = 0; p < nPrimitiveWalls_; p++)
+                 walls[p] = primitiveWalls_[p];
+               walls[nPrimitiveWalls_++] = new PrimitiveWall(lmp,(PRIMITIVE_WALL_DEFINITIONS::WallType)w,nPrimitiveArgs,argVec);
+               delete []primitiveWalls_;
+               primitiveWalls_ = walls;
+               primitiveWall_ = primitiveWalls_[0];
                setflag = true;
                break;
              }
@@ -310,6 +341,42 @@ FixWallGran::FixWallGran(LAMMPS *lmp, int narg, char **arg) :
           }
           hasargs = true;
           iarg_ += 1+n_FixMesh_;
+        } else if (strcmp(arg[iarg_],"contact_history") == 0) {
+          if (meshwall_ != 1)
+             error->fix_error(FLERR,this,"have to use keyword 'mesh' before using 'contact_history'");
+          if (iarg_+2 > narg)
+            error->fix_error(FLERR,this,"not enough arguments for 'contact_history'");
+          if (strcmp(arg[iarg_+1],"hash") == 0) hashContactHistory_ = true;
+          else if (strcmp(arg[iarg_+1],"default") == 0) hashContactHistory_ = false;
+          else error->fix_error(FLERR,this,"expecting 'hash' or 'default' after keyword 'contact_history'");
+          hasargs = true;
+          iarg_ += 2;
+        } else if (strcmp(arg[iarg_],"contact_order") == 0) {
+          if (iarg_+2 > narg)
+            error->fix_error(FLERR,this,"not enough arguments for 'contact_order'");
+          if (strcmp(arg[iarg_+1],"particle") == 0) particleMajor_ = true;
+          else if (strcmp(arg[iarg_+1],"triangle") == 0) particleMajor_ = false;
+          else error->fix_error(FLERR,this,"expecting 'particle' or 'triangle' after keyword 'contact_order'");
+          hasargs = true;
+          iarg_ += 2;
+        } else if (strcmp(arg[iarg_],"omp_resolve") == 0) {
+          if (iarg_+2 > narg)
+            error->fix_error(FLERR,this,"not enough arguments for 'omp_resolve'");
+          if (strcmp(arg[iarg_+1],"yes") == 0) ompResolve_ = true;
+          else if (strcmp(arg[iarg_+1],"no") == 0) ompResolve_ = false;
+          else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after keyword 'omp_resolve'");
+          hasargs = true;
+          iarg_ += 2;
+        } else if (strcmp(arg[iarg_],"incremental_neighlist") == 0) {
+          if (iarg_+2 > narg)
+            error->fix_error(FLERR,this,"not enough arguments for 'incremental_neighlist'");
+          if(!primitiveWall_)
+            error->fix_error(FLERR,this,"have to define primitive wall before 'incremental_neighlist'");
+          if (strcmp(arg[iarg_+1],"yes") == 0) incrementalPrimitiveNeighlist_ = true;
+          else if (strcmp(arg[iarg_+1],"no") == 0) incrementalPrimitiveNeighlist_ = false;
+          else error->fix_error(FLERR,this,"expecting 'yes' or 'no' after keyword 'incremental_neighlist'");
+          hasargs = true;
+          iarg_ += 2;
         } else if (strcmp(arg[iarg_],"shear") == 0) {
           if (iarg_+3 > narg)
             error->fix_error(FLERR,this,"not enough arguments for 'shear'");
@@ -322,14 +389,6 @@ FixWallGran::FixWallGran(LAMMPS *lmp, int narg, char **arg) :
           else error->fix_error(FLERR,this,"illegal 'shear' dim");
           vshear_ = force->numeric(FLERR,arg[iarg_+2]);
           shear_ = 1;
-
-          // update axis for cylinder etc if needed
-          if(shearDim_ != primitiveWall_->axis())
-          {
-            shearAxis_ = primitiveWall_->axis();
-            shearAxisVec_[shearAxis_] = vshear_;
-          }
-
           hasargs = true;
           iarg_ += 3;
         } else if (strcmp(arg[iarg_],"temperature") == 0) {
@@ -368,12 +427,30 @@ FixWallGran::FixWallGran(LAMMPS *lmp, int narg, char **arg) :
     if(meshwall_ == -1 && primitiveWall_ == 0)
         error->fix_error(FLERR,this,"Need to use define style 'mesh' or 'primitive'");
 
+    // hashed contact history catches the write_restart command
+    if(hashContactHistory_)
+        restart_global = 1;
+
+    // created atoms invalidate the incremental neighbor list, see set_arrays()
+    if(incrementalPrimitiveNeighlist_)
+        create_attribute = 1;
+
     if(primitiveWall_ && (modify->n_fixes_style("particletemplate/convexhull") > 0 || modify->n_fixes_style("particletemplate/concave") > 0))
         error->fix_error(FLERR,this,"style 'primitive' is not compatible with convex or concave particles");
 
     if(meshwall_ == 1 && !FixMesh_list_)
         error->fix_error(FLERR,this,"Need to provide the number and a list of meshes by using 'n_meshes' and 'meshes'");
 
+    // omp_resolve only threads the geometric resolve of mesh contacts
+#if !defined(_OPENMP)
+    if(ompResolve_)
+        error->fix_error(FLERR,this,"'omp_resolve' requires LIGGGHTS to be compiled with OpenMP");
+#endif
+    if(ompResolve_ && meshwall_ != 1)
+        error->fix_error(FLERR,this,"'omp_resolve' can only be used with style 'mesh'");
+    if(ompResolve_ && atom->superquadric_flag)
+        error->fix_error(FLERR,this,"'omp_resolve' can not be used with superquadric particles");
+
     if (modify->find_fix_style("continuum/weighted", 0))
         store_force_contact_stress_ = true;
 
@@ -487,7 +564,10 @@ void FixWallGran::post_create()
    {
        
        FixMesh_list_[i]->createWallNeighList(igroup);
-       FixMesh_list_[i]->createContactHistory(dnum());
+       if(hashContactHistory_)
+         contactHashes_.push_back(new ContactHistoryMeshHash(lmp,dnum()));
+       else
+         FixMesh_list_[i]->createContactHistory(dnum());
 
        if(store_force_contact_)
          FixMesh_list_[i]->createMeshforceContact();
@@ -496,29 +576,35 @@ void FixWallGran::post_create()
          FixMesh_list_[i]->createMeshforceContactStress();
    }
 
+   // hashed contact history travels with the atoms,
+   // the incremental neighbor list tracks migrating atoms
+   if(hashContactHistory_ || incrementalPrimitiveNeighlist_)
+     atom->add_callback(0);
+
    // contact history for primitive wall
    if(meshwall_ == 0 && dnum_ > 0)
    {
           char *hist_name = new char[strlen(id)+1+10];
           strcpy(hist_name,"history_");
           strcat(hist_name,id);
-          const char **fixarg = new const char*[8+dnum_];
+          const int nhist = dnum_*nPrimitiveWalls_;
+          const char **fixarg = new const char*[8+nhist];
           fixarg[0] = hist_name;
           fixarg[1] = "all";
           fixarg[2] = "property/atom";
           fixarg[3] = hist_name;
-          if (dnum_ > 1)
+          if (nhist > 1)
               fixarg[4] = "vector";
           else
               fixarg[4] = "vector_one_entry";
           fixarg[5] = "yes";    // restart
           fixarg[6] = "no";    // communicate ghost
           fixarg[7] = "no";    // communicate rev
-          for(int i = 8; i < 8+dnum_; i++)
+          for(int i = 8; i < 8+nhist; i++)
               fixarg[i] = "0.";
-          modify->add_fix(8+dnum_,const_cast<char**>(fixarg));
+          modify->add_fix(8+nhist,const_cast<char**>(fixarg));
           fix_history_primitive_ =
-              static_cast<FixPropertyAtom*>(modify->find_fix_property(hist_name,"property/atom","vector",dnum_,0,style));
+              static_cast<FixPropertyAtom*>(modify->find_fix_property(hist_name,"property/atom","vector",nhist,0,style));
           delete []fixarg;
           delete []hist_name;
    }
@@ -533,6 +619,8 @@ void FixWallGran::pre_delete(bool unfixflag)
         modify->delete_fix(fix_wallforce_->id);
     if(unfixflag && fix_history_primitive_)
         modify->delete_fix(fix_history_primitive_->id);
+    if(unfixflag && (hashContactHistory_ || incrementalPrimitiveNeighlist_))
+        atom->delete_callback(id,0);
 
     if(unfixflag && store_force_contact_ && 0 == meshwall_)
         modify->delete_fix(fix_wallforce_contact_->id);
@@ -564,7 +652,19 @@ void FixWallGran::pre_delete(bool unfixflag)
 
 FixWallGran::~FixWallGran()
 {
-    if(primitiveWall_ != 0) delete primitiveWall_;
+    for(int p = 0; p < nPrimitiveWalls_; p++)
+        delete primitiveWalls_[p];
+    delete []primitiveWalls_;
+    for(size_t i = 0; i < contactHashes_.size(); i++)
+        delete contactHashes_[i];
+    memory->destroy(primitiveNeigh_);
+    memory->destroy(primitiveNeighMask_);
+    memory->destroy(primitiveMask_);
+    memory->destroy(primitiveContactIdx_);
+    memory->destroy(primitiveContactWall_);
+    memory->destroy(primitiveContactRad_);
+    memory->destroy(primitiveContactDeltan_);
+    memory->destroy(primitiveContactDelta_);
     if(FixMesh_list_) delete []FixMesh_list_;
     delete impl;
 }
@@ -606,6 +706,30 @@ void FixWallGran::init()
 {
     dt_ = update->dt;
 
+    // owned contact lists are rebuilt in the first step of the run
+    ownedContactLists_.assign(n_FixMesh_,OwnedContactList());
+
+    // threaded mesh contact resolve is checked in the first step of the run
+    ompResolveCheckStep_ = -1;
+
+    // hashed contact history is not stored in restart files,
+    // a restart would silently continue without mesh contact history
+    if(hashContactHistory_ && output->restart_flag)
+        error->fix_error(FLERR,this,"contact history 'hash' can not be written to restart files, "
+                                    "use 'contact_history default' or no 'restart' command");
+
+    // incremental primitive neighbor list is keyed by atom tag,
+    // it starts with a full build in every run
+    if(incrementalPrimitiveNeighlist_)
+    {
+        if(atom->map_style == 0)
+          error->fix_error(FLERR,this,"'incremental_neighlist' requires an atom map, see atom_modify");
+        if(domain->triclinic)
+          error->fix_error(FLERR,this,"'incremental_neighlist' can not be used with triclinic boxes");
+        for(int p = 0; p < nPrimitiveWalls_; p++)
+          primitiveWalls_[p]->invalidateIncremental();
+    }
+
     // case granular
     if(strncmp(style,"wall/gran",9) == 0)
     {
@@ -725,11 +849,87 @@ void FixWallGran::pre_force(int vflag)
     // build neighlist for primitive walls
     
     if(rebuildPrimitiveNeighlist_)
-      primitiveWall_->buildNeighList(radius_ ? neighbor->skin:(r0_+neighbor->skin),x_,radius_,nlocal);
+    {
+      const double treshold = radius_ ? neighbor->skin:(r0_+neighbor->skin);
+      for(int p = 0; p < nPrimitiveWalls_; p++)
+      {
+        if(incrementalPrimitiveNeighlist_)
+          primitiveWalls_[p]->buildNeighListIncremental(treshold,x_,radius_,nlocal,neighbor->skin);
+        else
+          primitiveWalls_[p]->buildNeighList(treshold,x_,radius_,nlocal);
+      }
+      mergePrimitiveNeighLists(nlocal);
+    }
 
     rebuildPrimitiveNeighlist_ = false;
 }
 
+/* ----------------------------------------------------------------------
+   merge the neighbor lists of all primitives into one list holding
+   each atom once, with a bitmask of the primitives it is near
+------------------------------------------------------------------------- */
+
+void FixWallGran::mergePrimitiveNeighLists(int nlocal)
+{
+    if(nlocal > nmaxPrimitiveMask_)
+    {
+      nmaxPrimitiveMask_ = nlocal;
+      memory->destroy(primitiveMask_);
+      memory->create(primitiveMask_,nmaxPrimitiveMask_,"wall/gran:primitiveMask_");
+    }
+
+    for(int i = 0; i < nlocal; i++)
+      primitiveMask_[i] = 0;
+
+    int nPairs = 0;
+    for(int p = 0; p < nPrimitiveWalls_; p++)
+    {
+      int *neighborList;
+      const int nNeigh = primitiveWalls_[p]->getNeighbors(neighborList);
+      for(int iCont = 0; iCont < nNeigh; iCont++)
+        primitiveMask_[neighborList[iCont]] |= 1 << p;
+      nPairs += nNeigh;
+    }
+
+    if(nlocal > maxPrimitiveNeigh_)
+    {
+      maxPrimitiveNeigh_ = nlocal;
+      memory->destroy(primitiveNeigh_);
+      memory->destroy(primitiveNeighMask_);
+      memory->create(primitiveNeigh_,maxPrimitiveNeigh_,"wall/gran:primitiveNeigh_");
+      memory->create(primitiveNeighMask_,maxPrimitiveNeigh_,"wall/gran:primitiveNeighMask_");
+    }
+
+    nPrimitiveNeigh_ = 0;
+    for(int i = 0; i < nlocal; i++)
+    {
+      if(!primitiveMask_[i]) continue;
+      primitiveNeigh_[nPrimitiveNeigh_] = i;
+      primitiveNeighMask_[nPrimitiveNeigh_] = primitiveMask_[i];
+      nPrimitiveNeigh_++;
+    }
+
+    growPrimitiveContacts(nPairs);
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixWallGran::growPrimitiveContacts(int n)
+{
+    if(n <= maxPrimitiveContact_) return;
+    maxPrimitiveContact_ = n;
+    memory->destroy(primitiveContactIdx_);
+    memory->destroy(primitiveContactWall_);
+    memory->destroy(primitiveContactRad_);
+    memory->destroy(primitiveContactDeltan_);
+    memory->destroy(primitiveContactDelta_);
+    memory->create(primitiveContactIdx_,n,"wall/gran:primitiveContactIdx_");
+    memory->create(primitiveContactWall_,n,"wall/gran:primitiveContactWall_");
+    memory->create(primitiveContactRad_,n,"wall/gran:primitiveContactRad_");
+    memory->create(primitiveContactDeltan_,n,"wall/gran:primitiveContactDeltan_");
+    memory->create(primitiveContactDelta_,3*n,"wall/gran:primitiveContactDelta_");
+}
+
 /* ----------------------------------------------------------------------
    force on each atom calculated via post_force
    called via verlet
@@ -864,11 +1064,14 @@ void FixWallGran::post_force_mesh(int vflag)
     {
       TriMesh *mesh = FixMesh_list_[iMesh]->triMesh();
       nTriAll = mesh->sizeLocal() + mesh->sizeGhost();
-      FixContactHistoryMesh *fix_contact = FixMesh_list_[iMesh]->contactHistory();
+      FixContactHistoryMesh *fix_contact = hashContactHistory_ ? NULL : FixMesh_list_[iMesh]->contactHistory();
+      ContactHistoryMeshHash *hash_contact = hashContactHistory_ ? contactHashes_[iMesh] : NULL;
 
       // mark all contacts for delettion at this point
+      // the hash detects ended contacts from their step stamp instead
       
       if(fix_contact) fix_contact->markAllContacts();
+      if(hash_contact) hash_contact->beginStep();
 
       if(store_force_contact_)
         fix_wallforce_contact_ = FixMesh_list_[iMesh]->meshforceContact();
@@ -889,21 +1092,46 @@ void FixWallGran::post_force_mesh(int vflag)
 
       atom_type_wall_ = FixMesh_list_[iMesh]->atomTypeWall();
 
-      // loop owned and ghost triangles
-      for(int iTri = 0; iTri < nTriAll; iTri++)
+      // owned particles of the contact lists, ghost particles are
+      // not handled
+      OwnedContactList &owned = ownedContactLists_[iMesh];
+      if(owned.stamp != neighbor->lastcall || owned.nTri != nTriAll || owned.nlocal != nlocal)
+        buildOwnedContactList(iMesh,meshNeighlist,nTriAll,nlocal);
+      const int *ownedFirst = &owned.first[0];
+      const int *ownedPart = owned.part.empty() ? NULL : &owned.part[0];
+
+      // geometric resolve of all pairs ahead of the contact loop,
+      // threaded over the triangles if compiled with OpenMP
+      // the contact loop stays serial and in order, so forces, contact
+      // history and stresses are accumulated deterministically
+      const bool presolved = ompResolve_ && !atom->superquadric_flag && !fix_store_multicontact_data_;
+      if(presolved)
+        resolveMeshContacts(mesh,nTriAll,ownedFirst,ownedPart);
+
+      // loop contact list entries of owned and ghost triangles,
+      // either triangle by triangle or particle by particle
+      const int nPairs = ownedFirst[nTriAll];
+      const int *ownedTri = owned.tri.empty() ? NULL : &owned.tri[0];
+      const int *visit = (particleMajor_ && nPairs > 0) ? &owned.visit[0] : NULL;
+
+      for(int k = 0; k < nPairs; k++)
       {
-          const std::vector<int> & neighborList = meshNeighlist->get_contact_list(iTri);
-          const int numneigh = neighborList.size();
-          for(int iCont = 0; iCont < numneigh; iCont++)
-          {
-            
-            const int iPart = neighborList[iCont];
-
-            // do not handle ghost particles
-            if (iPart >= nlocal) continue;
+            const int iCont = visit ? visit[k] : k;
+            const int iTri = ownedTri[iCont];
+            const int iPart = ownedPart[iCont];
 
             int idTri = mesh->id(iTri);
 
+            if(presolved)
+            {
+                sidata.radi = radius_ ? radius_[iPart] : r0_;
+                deltan = resolvedDeltan_[iCont];
+                vectorCopy3D(&resolvedDelta_[3*iCont],delta);
+                vectorCopy3D(&resolvedBary_[3*iCont],bary);
+                barysign = resolvedBarysign_[iCont];
+            }
+            else
+            {
             #ifdef SUPERQUADRIC_ACTIVE_FLAG
                 if(atom->superquadric_flag) {
                   #ifdef LIGGGHTS_DEBUG
@@ -953,6 +1181,7 @@ void FixWallGran::post_force_mesh(int vflag)
                 
                 deltan = mesh->resolveTriSphereContactBary(iPart, iTri, sidata.radi, x_[iPart], delta, bary, barysign, atom->shapetype_flag ? false : true);
             #endif
+            }
             
             if(deltan > cutneighmax_) continue;
 
@@ -966,7 +1195,10 @@ void FixWallGran::post_force_mesh(int vflag)
             {
                 
                 sidata.j = iTri;
-                fix_contact->handleContact(iPart,idTri,sidata.contact_history,intersectflag,false);
+                if(hash_contact)
+                  hash_contact->handleContact(iPart,idTri,sidata.contact_history,intersectflag,false,mesh);
+                else
+                  fix_contact->handleContact(iPart,idTri,sidata.contact_history,intersectflag,false);
                 if(vMeshC)
                 {
                     for(int i = 0; i < 3; i++)
@@ -990,6 +1222,7 @@ void FixWallGran::post_force_mesh(int vflag)
             {
               
               if(!atom->shapetype_flag && fix_contact && ! fix_contact->handleContact(iPart,idTri,sidata.contact_history,intersectflag,7 == barysign)) continue;
+              if(!atom->shapetype_flag && hash_contact && ! hash_contact->handleContact(iPart,idTri,sidata.contact_history,intersectflag,7 == barysign,mesh)) continue;
 
               if(vMeshC && !atom->shapetype_flag)
               {
@@ -1010,7 +1243,6 @@ void FixWallGran::post_force_mesh(int vflag)
                 compute_force(sidata, v_wall); // LEGACY CODE (SPH)
               }
             }
-          }
       }
 
       // clean-up contacts
@@ -1019,6 +1251,170 @@ void FixWallGran::post_force_mesh(int vflag)
     }
 }
 
+/* ----------------------------------------------------------------------
+   copy the owned particles of the mesh contact lists into one CSR list
+   the mesh neighbor lists are rebuilt on reneighboring steps only
+------------------------------------------------------------------------- */
+
+void FixWallGran::buildOwnedContactList(int iMesh, FixNeighlistMesh *meshNeighlist, int nTriAll, int nlocal)
+{
+    OwnedContactList &owned = ownedContactLists_[iMesh];
+
+    owned.first.resize(nTriAll+1);
+    owned.part.clear();
+    owned.tri.clear();
+    for(int iTri = 0; iTri < nTriAll; iTri++)
+    {
+      owned.first[iTri] = owned.part.size();
+      const std::vector<int> & neighborList = meshNeighlist->get_contact_list(iTri);
+      const int numneigh = neighborList.size();
+      for(int iCont = 0; iCont < numneigh; iCont++)
+      {
+        if(neighborList[iCont] < nlocal)
+        {
+          owned.part.push_back(neighborList[iCont]);
+          owned.tri.push_back(iTri);
+        }
+      }
+    }
+    owned.first[nTriAll] = owned.part.size();
+
+    // particle-major visiting order: counting sort of the entries by
+    // particle, triangles of a particle stay in ascending order
+    if(particleMajor_)
+    {
+      const int nPairs = owned.part.size();
+      std::vector<int> start(nlocal+1,0);
+      for(int iCont = 0; iCont < nPairs; iCont++)
+        start[owned.part[iCont]+1]++;
+      for(int i = 0; i < nlocal; i++)
+        start[i+1] += start[i];
+      owned.visit.resize(nPairs);
+      for(int iCont = 0; iCont < nPairs; iCont++)
+        owned.visit[start[owned.part[iCont]]++] = iCont;
+    }
+
+    owned.stamp = neighbor->lastcall;
+    owned.nTri = nTriAll;
+    owned.nlocal = nlocal;
+}
+
+/* ----------------------------------------------------------------------
+   resolve the triangle-sphere distance of all owned contact list entries
+   of a mesh, threaded over the triangles
+   TriMesh::resolveTriSphereContactBary() has to be re-entrant, i.e. only
+   read mesh and atom data; as this can not be guaranteed for every mesh
+   implementation, the first resolve of a run is repeated serially and
+   has to agree bit for bit
+------------------------------------------------------------------------- */
+
+void FixWallGran::resolveMeshContacts(TriMesh *mesh, int nTriAll, const int *ownedFirst, const int *ownedPart)
+{
+    const int nPairs = ownedFirst[nTriAll];
+    if(static_cast<int>(resolvedDeltan_.size()) < nPairs)
+    {
+      resolvedDeltan_.resize(nPairs);
+      resolvedDelta_.resize(3*nPairs);
+      resolvedBary_.resize(3*nPairs);
+      resolvedBarysign_.resize(nPairs);
+    }
+    if(nPairs == 0) return;
+
+    resolveMeshContactRange(mesh,nTriAll,ownedFirst,ownedPart,
+        &resolvedDeltan_[0],&resolvedDelta_[0],&resolvedBary_[0],&resolvedBarysign_[0],true);
+
+    if(ompResolveCheckStep_ < 0)
+      ompResolveCheckStep_ = update->ntimestep;
+    if(update->ntimestep != ompResolveCheckStep_)
+      return;
+
+    std::vector<double> sDeltan(nPairs), sDelta(3*nPairs), sBary(3*nPairs);
+    std::vector<int> sBarysign(nPairs);
+    resolveMeshContactRange(mesh,nTriAll,ownedFirst,ownedPart,
+        &sDeltan[0],&sDelta[0],&sBary[0],&sBarysign[0],false);
+
+    if(memcmp(&sDeltan[0],&resolvedDeltan_[0],nPairs*sizeof(double)) ||
+       memcmp(&sDelta[0],&resolvedDelta_[0],3*nPairs*sizeof(double)) ||
+       memcmp(&sBary[0],&resolvedBary_[0],3*nPairs*sizeof(double)) ||
+       memcmp(&sBarysign[0],&resolvedBarysign_[0],nPairs*sizeof(int)))
+      error->one(FLERR,"Fix wall/gran: 'omp_resolve': threaded and serial geometric resolve differ, "
+                       "the mesh contact resolve is not re-entrant; use 'omp_resolve no'");
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixWallGran::resolveMeshContactRange(TriMesh *mesh, int nTriAll, const int *ownedFirst, const int *ownedPart,
+                                          double *rDeltan, double *rDelta, double *rBary, int *rBarysign, bool threaded)
+{
+    double **x = x_;
+    double *radius = radius_;
+    const double r0 = r0_;
+    const bool treatEdge = atom->shapetype_flag ? false : true;
+
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(dynamic,64) if(threaded)
+#endif
+    for(int iTri = 0; iTri < nTriAll; iTri++)
+    {
+      for(int iCont = ownedFirst[iTri]; iCont < ownedFirst[iTri+1]; iCont++)
+      {
+        const int iPart = ownedPart[iCont];
+        const double radi = radius ? radius[iPart] : r0;
+        rDeltan[iCont] = mesh->resolveTriSphereContactBary(iPart, iTri, radi, x[iPart], &rDelta[3*iCont], &rBary[3*iCont], rBarysign[iCont], treatEdge);
+      }
+    }
+}
+
+/* ----------------------------------------------------------------------
+   hashed mesh contact history of migrating atoms,
+   incremental primitive neighbor list is told about migrations
+------------------------------------------------------------------------- */
+
+int FixWallGran::pack_exchange(int i, double *buf)
+{
+    int m = 0;
+    for(size_t iMesh = 0; iMesh < contactHashes_.size(); iMesh++)
+        m += contactHashes_[iMesh]->pack_exchange(i,&buf[m]);
+    if(incrementalPrimitiveNeighlist_)
+        for(int p = 0; p < nPrimitiveWalls_; p++)
+            primitiveWalls_[p]->incrementalDeparture();
+    return m;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixWallGran::unpack_exchange(int nlocal, double *buf)
+{
+    int m = 0;
+    for(size_t iMesh = 0; iMesh < contactHashes_.size(); iMesh++)
+        m += contactHashes_[iMesh]->unpack_exchange(nlocal,&buf[m]);
+    if(incrementalPrimitiveNeighlist_)
+        for(int p = 0; p < nPrimitiveWalls_; p++)
+            primitiveWalls_[p]->incrementalArrival(atom->tag[nlocal]);
+    return m;
+}
+
+/* ----------------------------------------------------------------------
+   hashed contact history can not be restarted, see init()
+------------------------------------------------------------------------- */
+
+void FixWallGran::write_restart(FILE *fp)
+{
+    error->fix_error(FLERR,this,"contact history 'hash' can not be written to restart files, "
+                                "use 'contact_history default'");
+}
+
+/* ----------------------------------------------------------------------
+   atom created, e.g. by particle insertion
+------------------------------------------------------------------------- */
+
+void FixWallGran::set_arrays(int i)
+{
+    if(incrementalPrimitiveNeighlist_)
+        for(int p = 0; p < nPrimitiveWalls_; p++)
+            primitiveWalls_[p]->invalidateIncremental();
+}
+
 /* ----------------------------------------------------------------------
    post_force for primitive wall
 ------------------------------------------------------------------------- */
@@ -1040,28 +1436,59 @@ void FixWallGran::post_force_primitive(int vflag)
   if(dnum() > 0)
     c_history = fix_history_primitive_->array_atom;
 
-  // if shear, set velocity accordingly
-  if (shear_) v_wall[shearDim_] = vshear_;
+  // gather the neighbors of each primitive that are in the group,
+  // resolve them in one batch per primitive and collect the results
+  int nContact = 0;
+  for (int p = 0; p < nPrimitiveWalls_; p++)
+  {
+    const int bit = 1 << p;
+    int *batchIdx;
+    double *batchRad, *batchDeltan, *batchDelta;
+    primitiveWalls_[p]->prepareBatch(nPrimitiveNeigh_,batchIdx,batchRad);
 
-  // loop neighbor list
-  int *neighborList;
-  int nNeigh = primitiveWall_->getNeighbors(neighborList);
+    int nBatch = 0;
+    for (int iCont = 0; iCont < nPrimitiveNeigh_; iCont++)
+    {
+      if(!(primitiveNeighMask_[iCont] & bit)) continue;
 
-  for (int iCont = 0; iCont < nNeigh ; iCont++, neighborList++)
-  {
-    int iPart = *neighborList;
+      const int iPart = primitiveNeigh_[iCont];
+
+      if(!(mask[iPart] & groupbit)) continue;
+
+      double radi = radius_ ? radius_[iPart] : r0_;
+      if (fix_store_multicontact_data_)
+      {
+          double * deltaData = NULL;
+          const bool contact = fix_store_multicontact_data_->haveContact(iPart, 1, deltaData);
+          if (contact)
+              radi += deltaData[3];
+      }
+      batchIdx[nBatch] = iPart;
+      batchRad[nBatch] = radi;
+      nBatch++;
+    }
 
-    if(!(mask[iPart] & groupbit)) continue;
+    primitiveWalls_[p]->resolveContactBatch(nBatch,x_,batchDeltan,batchDelta);
 
-    sidata.radi = radius_ ? radius_[iPart] : r0_;
-    if (fix_store_multicontact_data_)
+    for (int iBatch = 0; iBatch < nBatch; iBatch++, nContact++)
     {
-        double * deltaData = NULL;
-        const bool contact = fix_store_multicontact_data_->haveContact(iPart, 1, deltaData);
-        if (contact)
-            sidata.radi += deltaData[3];
+      primitiveContactIdx_[nContact] = batchIdx[iBatch];
+      primitiveContactWall_[nContact] = p;
+      primitiveContactRad_[nContact] = batchRad[iBatch];
+      primitiveContactDeltan_[nContact] = batchDeltan[iBatch];
+      vectorCopy3D(&batchDelta[3*iBatch],&primitiveContactDelta_[3*nContact]);
     }
-    deltan = primitiveWall_->resolveContact(x_[iPart], sidata.radi, delta);
+  }
+
+  // loop contacts of all primitives
+  for (int iContact = 0; iContact < nContact; iContact++)
+  {
+    int iPart = primitiveContactIdx_[iContact];
+    double *hist = c_history ? &c_history[iPart][dnum_*primitiveContactWall_[iContact]] : NULL;
+
+    sidata.radi = primitiveContactRad_[iContact];
+    deltan = primitiveContactDeltan_[iContact];
+    vectorCopy3D(&primitiveContactDelta_[3*iContact],delta);
 
     if(deltan>cutneighmax_) continue;
 
@@ -1112,21 +1539,33 @@ void FixWallGran::post_force_primitive(int vflag)
       }
       #endif
 
-      if(shear_ && shearAxis_ >= 0)
+      // if shear, set velocity accordingly
+      // primitives with an axis other than the shear dim (cylinder etc)
+      // rotate about their own axis
+      if(shear_)
       {
-          primitiveWall_->calcRadialDistance(x_[iPart],rdist);
-          vectorCross3D(shearAxisVec_,rdist,v_wall);
-          
+          PrimitiveWall *wall = primitiveWalls_[primitiveContactWall_[iContact]];
+          const int axis = wall->axis();
+          vectorZeroize3D(v_wall);
+          if(axis >= 0 && axis != shearDim_)
+          {
+              double axisVec[3] = {0.,0.,0.};
+              axisVec[axis] = vshear_;
+              wall->calcRadialDistance(x_[iPart],rdist);
+              vectorCross3D(axisVec,rdist,v_wall);
+          }
+          else
+              v_wall[shearDim_] = vshear_;
       }
       sidata.i = iPart;
-      sidata.contact_history = c_history ? c_history[iPart] : NULL;
+      sidata.contact_history = hist;
 
       if(    (atom->superquadric_flag && deltan > 0.0)
           || (atom->shapetype_flag && !impl->checkSurfaceIntersect(sidata)))
       {
-        if(c_history)
-            vectorZeroizeN(c_history[iPart],dnum_);
-        break;
+        if(hist)
+            vectorZeroizeN(hist,dnum_);
+        continue;
       }
 
       if(!sidata.is_non_spherical || atom->superquadric_flag)
@@ -1149,9 +1588,9 @@ void FixWallGran::post_force_primitive(int vflag)
     
     else
     {
-      if(c_history)
+      if(hist)
       {
-         vectorZeroizeN(c_history[iPart],dnum_);
+         vectorZeroizeN(hist,dnum_);
       }
     }
   }
@@ -1195,7 +1634,12 @@ int FixWallGran::n_contacts_local(int &nIntersect)
 
     int ncontacts = 0;
     for(int i = 0; i < n_FixMesh_; i++)
-        ncontacts += FixMesh_list_[i]->contactHistory()->n_contacts(nIntersect);
+    {
+        if(hashContactHistory_)
+            ncontacts += contactHashes_[i]->n_contacts(nIntersect);
+        else
+            ncontacts += FixMesh_list_[i]->contactHistory()->n_contacts(nIntersect);
+    }
 
     return ncontacts;
 }
@@ -1221,7 +1665,12 @@ int FixWallGran::n_contacts_local(int contact_groupbit, int &nIntersect)
 
     int ncontacts = 0;
     for(int i = 0; i < n_FixMesh_; i++)
-        ncontacts += FixMesh_list_[i]->contactHistory()->n_contacts(contact_groupbit, nIntersect);
+    {
+        if(hashContactHistory_)
+            ncontacts += contactHashes_[i]->n_contacts(contact_groupbit, nIntersect);
+        else
+            ncontacts += FixMesh_list_[i]->contactHistory()->n_contacts(contact_groupbit, nIntersect);
+    }
 
     return ncontacts;
 }
@@ -1264,6 +1713,9 @@ void FixWallGran::init_heattransfer()
     fppa_T = NULL;
     fppa_hf = NULL;
     fppa_htcw = NULL;
+    fppa_gw = NULL;
+    fppa_gwt = NULL;
+    fix_heat_gran_ = NULL;
     deltan_ratio = NULL;
 
     // decide if heat transfer is to be calculated
@@ -1293,6 +1745,13 @@ void FixWallGran::init_heattransfer()
     fppa_hf = static_cast<FixPropertyAtom*>(modify->find_fix_property("heatFlux","property/atom","scalar",1,0,style));
     fppa_htcw = static_cast<FixPropertyAtom*>(modify->find_fix_property("wallHeattransferCoeff","property/atom","scalar",1,0,style,false));
 
+    // wall conductances for steady-state mode of heat/gran/conduction
+    fppa_gw = static_cast<FixPropertyAtom*>(modify->find_fix_property("wallConductance","property/atom","scalar",1,0,style,false));
+    fppa_gwt = static_cast<FixPropertyAtom*>(modify->find_fix_property("wallConductanceTemp","property/atom","scalar",1,0,style,false));
+
+    // wall contacts may be recorded by heat/gran
+    fix_heat_gran_ = static_cast<FixHeatGran*>(modify->find_fix_style("heat/gran",0));
+
     th_cond = static_cast<FixPropertyGlobal*>(modify->find_fix_property("thermalConductivity","property/global","peratomtype",0,0,style))->get_values();
 
     // if youngsModulusOriginal defined, get deltan_ratio
@@ -1391,6 +1850,9 @@ void FixWallGran::addHeatFlux(TriMesh *mesh,int ip, const double ri, double delt
     if ((fabs(tcop) < SMALL) || (fabs(tcowall) < SMALL)) hc = 0.;
     else hc = 4.*tcop*tcowall/(tcop+tcowall)*sqrt(Acont);
 
+    if(computeflag_ && fix_heat_gran_ && fix_heat_gran_->records_contacts())
+        fix_heat_gran_->record_wall_contact(ip,atom_type_wall_,delta_n,Acont,Temp_wall);
+
     if(computeflag_)
     {
         double hf = (Temp_wall-Temp_p[ip]) * hc;
@@ -1399,6 +1861,12 @@ void FixWallGran::addHeatFlux(TriMesh *mesh,int ip, const double ri, double delt
         
         if(fppa_htcw)
             fppa_htcw->vector_atom[ip] = hc;
+
+        if(fppa_gw && fppa_gwt)
+        {
+            fppa_gw->vector_atom[ip] += hc;
+            fppa_gwt->vector_atom[ip] += hc*Temp_wall;
+        }
     }
     if(cwl_ && addflag_)
         cwl_->add_heat_wall(ip,(Temp_wall-Temp_p[ip]) * hc);
@@ -75,6 +75,10 @@ class FixWallGran : public Fix, public LIGGGHTS::IContactHistorySetup {
   virtual int setmask();
   virtual void post_create();
   virtual void pre_delete(bool unfixflag);
+  virtual int pack_exchange(int i, double *buf);
+  virtual int unpack_exchange(int nlocal, double *buf);
+  virtual void set_arrays(int i);
+  virtual void write_restart(FILE *fp);
   virtual void init();
   virtual void setup(int vflag);
   virtual void post_force(int vflag);
@@ -260,6 +264,38 @@ class FixWallGran : public Fix, public LIGGGHTS::IContactHistorySetup {
   // references to mesh walls
   int n_FixMesh_;
   class FixMeshSurface **FixMesh_list_;
+
+  // contact lists of the meshes restricted to owned particles,
+  // CSR over all triangles, rebuilt with the mesh neighbor lists
+  // tri holds the triangle of each entry, visit the entries ordered
+  // by particle if particleMajor_
+  struct OwnedContactList
+  {
+    bigint stamp;
+    int nTri, nlocal;
+    std::vector<int> first, part, tri, visit;
+    OwnedContactList() : stamp(-1), nTri(0), nlocal(0) {}
+  };
+  std::vector<OwnedContactList> ownedContactLists_;
+  bool particleMajor_;
+  void buildOwnedContactList(int iMesh, class FixNeighlistMesh *meshNeighlist, int nTriAll, int nlocal);
+
+  // mesh contact history backend: FixContactHistoryMesh of the meshes,
+  // or one hash per mesh owned by this fix
+  bool hashContactHistory_;
+  std::vector<class ContactHistoryMeshHash*> contactHashes_;
+
+  // geometric resolve of the mesh contacts ahead of the contact loop,
+  // threaded with OpenMP; force, contact history and stress accumulation
+  // remain serial; checked against a serial resolve at the first step
+  // of each run, see resolveMeshContacts()
+  bool ompResolve_;
+  bigint ompResolveCheckStep_;
+  std::vector<double> resolvedDeltan_, resolvedDelta_, resolvedBary_;
+  std::vector<int> resolvedBarysign_;
+  void resolveMeshContacts(class TriMesh *mesh, int nTriAll, const int *ownedFirst, const int *ownedPart);
+  void resolveMeshContactRange(class TriMesh *mesh, int nTriAll, const int *ownedFirst, const int *ownedPart,
+                               double *rDeltan, double *rDelta, double *rBary, int *rBarysign, bool threaded);
   class FixRigid *fix_rigid_;
   int *body_;
   double *masstotal_;
@@ -268,6 +304,11 @@ class FixWallGran : public Fix, public LIGGGHTS::IContactHistorySetup {
   class FixPropertyAtom *fppa_T;
   class FixPropertyAtom *fppa_hf;
   class FixPropertyAtom *fppa_htcw; 
+  class FixPropertyAtom *fppa_gw;
+  class FixPropertyAtom *fppa_gwt;
+
+  // heat/gran fix recording wall contacts
+  class FixHeatGran *fix_heat_gran_;
 
   double Temp_wall;
   double fixed_contact_area_;
@@ -292,9 +333,8 @@ class FixWallGran : public Fix, public LIGGGHTS::IContactHistorySetup {
 
   int nlevels_respa_;
 
-  int shear_, shearDim_, shearAxis_;
+  int shear_, shearDim_;
   double vshear_;
-  double shearAxisVec_[3];
 
   // distance in order to calculate interaction with
   // rough wall
@@ -313,12 +353,34 @@ class FixWallGran : public Fix, public LIGGGHTS::IContactHistorySetup {
   // true if any of the meshes tracks stresses
   bool stress_flag_;
 
+  // all primitives of this fix, primitiveWall_ is the first one
+  // contact history holds dnum_ values per primitive
+  int nPrimitiveWalls_;
+  class PrimitiveWall **primitiveWalls_;
   class PrimitiveWall *primitiveWall_;
   class FixPropertyAtom *fix_history_primitive_;
 
+  // merged neighbor list of the primitives: atom index and a bitmask
+  // of the primitives it is near
+  int nPrimitiveNeigh_, maxPrimitiveNeigh_;
+  int *primitiveNeigh_, *primitiveNeighMask_;
+  int nmaxPrimitiveMask_;
+  int *primitiveMask_;
+  void mergePrimitiveNeighLists(int nlocal);
+
+  // primitive contacts of the current step, resolved per primitive
+  int maxPrimitiveContact_;
+  int *primitiveContactIdx_, *primitiveContactWall_;
+  double *primitiveContactRad_, *primitiveContactDeltan_, *primitiveContactDelta_;
+  void growPrimitiveContacts(int n);
+
   // class to keep track of wall contacts
   bool rebuildPrimitiveNeighlist_;
 
+  // incremental primitive neighbor list: re-test only atoms that may
+  // have entered the list, see PrimitiveWall::buildNeighListIncremental()
+  bool incrementalPrimitiveNeighlist_;
+
   // force storage
   bool store_force_;
   class FixPropertyAtom *fix_wallforce_;
@@ -45,8 +45,13 @@
 #define LMP_PRIMITIVE_WALL
 
 #include "container.h"
+#include "atom.h"
+#include "domain.h"
 #include "neighbor.h"
+#include "memory.h"
+#include "error.h"
 #include "primitive_wall_definitions.h"
+#include <vector>
 
 namespace LAMMPS_NS
 {
@@ -60,16 +65,25 @@ namespace LAMMPS_NS
       public:
 
         PrimitiveWall(LAMMPS *lmp,PRIMITIVE_WALL_DEFINITIONS::WallType wType_, int nParam_, double *param_)
-        : Pointers(lmp), neighlist("neighlist"), wType(wType_), nParam(nParam_)
+        : Pointers(lmp), neighlist("neighlist"), wType(wType_), nParam(nParam_),
+          batchMax(0), batchIdx(0), batchRad(0), batchDeltan(0), batchDelta(0),
+          incValid(false), incBuild(0), incAccounted(0), incFullCountdown(0),
+          incBucket(INC_NBUCKET)
         {
             param = new double[nParam];
             for(int i=0;i<nParam;i++)
               param[i] = param_[i];
+            if(!PRIMITIVE_WALL_DEFINITIONS::chooseSetup(param,wType))
+              error->all(FLERR,"Illegal parameters for primitive wall");
         }
 
         virtual ~PrimitiveWall()
         {
             delete []param;
+            memory->destroy(batchIdx);
+            memory->destroy(batchRad);
+            memory->destroy(batchDeltan);
+            memory->destroy(batchDelta);
         }
 
         inline int getNeighbors(int *&contactPtr);
@@ -79,8 +93,20 @@ namespace LAMMPS_NS
 
         inline void buildNeighList(double neighCutoff, double **x, double *r, int nPart);
 
+        // incremental neighbor list, see buildNeighListIncremental()
+        inline void buildNeighListIncremental(double neighCutoff, double **x, double *r, int nPart, double skin);
+        inline void invalidateIncremental();
+        inline void incrementalDeparture();
+        inline void incrementalArrival(int tag);
+
         inline double resolveContact(double *x, double r, double *delta);
         inline bool resolveNeighlist(double *x, double r, double treshold);
+        inline bool resolveNeighlistBox(double *lo, double *hi, double dMax);
+
+        // batch contact resolve: fill idx and rad of prepareBatch(),
+        // resolveContactBatch() then provides deltan and delta per entry
+        inline void prepareBatch(int n, int *&idx, double *&rad);
+        inline void resolveContactBatch(int n, double **x, double *&deltan, double *&delta);
 
         inline int axis();
         inline double calcRadialDistance(double *pos, double *distvec);
@@ -97,6 +123,33 @@ namespace LAMMPS_NS
         double *param;
         int nParam;
 
+        // scratch for batch evaluation
+        int batchMax;
+        int *batchIdx;
+        double *batchRad, *batchDeltan, *batchDelta;
+        inline void growBatch(int n);
+
+        // incremental neighbor list, keyed by atom tag since local indices
+        // change with sorting and migration
+        // incNear: atoms in the list, re-tested at every build
+        // incBucket: atoms outside the list, filed under the build at which
+        //   they could have entered it at the earliest
+        // incArrived: atoms migrated to this process since the last build
+        enum {INC_NBUCKET = 64, INC_FULL_EVERY = 256};
+        bool incValid;
+        int incBuild, incAccounted, incFullCountdown;
+        std::vector<int> incNear, incArrived, incSeen;
+        std::vector<std::vector<int> > incBucket;
+
+        // incremental build for a concrete geometry G, see
+        // PRIMITIVE_WALL_DEFINITIONS::dispatchWallType()
+        template<class G>
+        inline void buildNeighListIncrementalT(double neighCutoff, double **x, double *r, int nPart, double skin);
+        template<class G>
+        inline void testIncrementalT(int iPart, double neighCutoff, double **x, double *r, double skin);
+        struct IncrementalOp;
+        friend struct IncrementalOp;
+
   };
 
   /*
@@ -115,7 +168,7 @@ namespace LAMMPS_NS
 
   double PrimitiveWall::calcRadialDistance(double *pos, double *distvec)
   {
-    return PRIMITIVE_WALL_DEFINITIONS::chooseCalcRadialDistance(pos, param, distvec[0],distvec[1],distvec[2], wType);
+    return PRIMITIVE_WALL_DEFINITIONS::chooseCalcRadialDistance(pos, param, distvec, wType);
   }
 
   bool PrimitiveWall::resolveNeighlist(double *x, double r, double treshold)
@@ -123,6 +176,41 @@ namespace LAMMPS_NS
     return PRIMITIVE_WALL_DEFINITIONS::chooseNeighlistTemplate(x,r,treshold,param,wType);
   }
 
+  bool PrimitiveWall::resolveNeighlistBox(double *lo, double *hi, double dMax)
+  {
+    return PRIMITIVE_WALL_DEFINITIONS::chooseNeighlistBoxTemplate(lo,hi,dMax,param,wType);
+  }
+
+  void PrimitiveWall::growBatch(int n)
+  {
+    if(n <= batchMax) return;
+    batchMax = n;
+    memory->destroy(batchIdx);
+    memory->destroy(batchRad);
+    memory->destroy(batchDeltan);
+    memory->destroy(batchDelta);
+    memory->create(batchIdx,batchMax,"PrimitiveWall:batchIdx");
+    memory->create(batchRad,batchMax,"PrimitiveWall:batchRad");
+    memory->create(batchDeltan,batchMax,"PrimitiveWall:batchDeltan");
+    memory->create(batchDelta,3*batchMax,"PrimitiveWall:batchDelta");
+  }
+
+  void PrimitiveWall::prepareBatch(int n, int *&idx, double *&rad)
+  {
+    growBatch(n);
+    idx = batchIdx;
+    rad = batchRad;
+  }
+
+  // positions are read from the contiguous block behind x
+  void PrimitiveWall::resolveContactBatch(int n, double **x, double *&deltan, double *&delta)
+  {
+    if(n > 0)
+      PRIMITIVE_WALL_DEFINITIONS::chooseContactBatchTemplate(x[0],batchIdx,batchRad,n,param,batchDeltan,batchDelta,wType);
+    deltan = batchDeltan;
+    delta = batchDelta;
+  }
+
   int PrimitiveWall::getNeighbors(int *&contactPtr)
   {
     contactPtr = neighlist.begin();
@@ -132,14 +220,157 @@ namespace LAMMPS_NS
   void PrimitiveWall::buildNeighList(double treshold, double **x, double *r, int nPart)
   {
     neighlist.clearContainer();
+    if(nPart == 0)
+      return;
+
+    // owned particles lie in the sub-domain after reneighboring, if it can
+    // not reach the wall, no particle can and the per-particle test is skipped
+    // the neighbor cutoff bounds the particle radius
+    if(!domain->triclinic &&
+       !resolveNeighlistBox(domain->sublo,domain->subhi,neighbor->cutneighmax+treshold))
+      return;
+
+    // flag all particles in one sweep, then compact
+    growBatch(nPart);
+    PRIMITIVE_WALL_DEFINITIONS::chooseNeighlistBatchTemplate(x[0],r,nPart,treshold,param,batchIdx,wType);
     for(int iPart=0;iPart<nPart;iPart++)
     {
-      
-      if(resolveNeighlist(x[iPart],r?r[iPart]:0.,treshold))
+      if(batchIdx[iPart])
         neighlist.add(iPart);
     }
   }
 
+  /*
+   * incremental neighbor list
+   * a particle outside the list is re-tested only at the build at which it
+   * could have entered the list at the earliest: its distance to the list
+   * boundary shrinks by at most skin per build (as for buildNeighList(),
+   * a particle has to move by more than skin to reach the wall unlisted)
+   * and it may only be wrapped by a periodic boundary it is close to
+   * resolveContact() must not overestimate the distance to the wall
+   * particle radii have to be constant, a full build is done every
+   * INC_FULL_EVERY builds and whenever atoms appeared otherwise than by
+   * migration, see incrementalDeparture(), incrementalArrival()
+   */
+
+  struct PrimitiveWall::IncrementalOp
+  {
+    PrimitiveWall *wall;
+    double treshold, **x, *r;
+    int nPart;
+    double skin;
+    template<PRIMITIVE_WALL_DEFINITIONS::WallType W> void run()
+    { wall->buildNeighListIncrementalT<typename PRIMITIVE_WALL_DEFINITIONS::Primitive<W>::type>(treshold,x,r,nPart,skin); }
+    void fallback()
+    { wall->buildNeighList(treshold,x,r,nPart); wall->invalidateIncremental(); }
+  };
+
+  void PrimitiveWall::buildNeighListIncremental(double treshold, double **x, double *r, int nPart, double skin)
+  {
+    IncrementalOp op = {this,treshold,x,r,nPart,skin};
+    PRIMITIVE_WALL_DEFINITIONS::dispatchWallType(wType,op);
+  }
+
+  // next build is a full one, e.g. after atoms were created or at a new run
+  void PrimitiveWall::invalidateIncremental()
+  {
+    incValid = false;
+  }
+
+  // atom migrates to another process
+  void PrimitiveWall::incrementalDeparture()
+  {
+    incAccounted--;
+  }
+
+  // atom migrated to this process, it is re-tested at the next build
+  void PrimitiveWall::incrementalArrival(int tag)
+  {
+    incAccounted++;
+    if(incValid)
+      incArrived.push_back(tag);
+  }
+
+  template<class G>
+  void PrimitiveWall::buildNeighListIncrementalT(double treshold, double **x, double *r, int nPart, double skin)
+  {
+    neighlist.clearContainer();
+    incBuild++;
+
+    // atoms were created or deleted since the last build
+    if(nPart != incAccounted)
+      incValid = false;
+
+    if(!incValid || --incFullCountdown <= 0)
+    {
+      incNear.clear();
+      incArrived.clear();
+      for(int b = 0; b < INC_NBUCKET; b++)
+        incBucket[b].clear();
+      for(int iPart = 0; iPart < nPart; iPart++)
+        testIncrementalT<G>(iPart,treshold,x,r,skin);
+      incValid = true;
+      incAccounted = nPart;
+      incFullCountdown = INC_FULL_EVERY;
+      return;
+    }
+
+    // candidates are the listed atoms, the atoms due at this build and
+    // the arrived atoms; departed atoms are no longer owned and skipped
+    if(static_cast<int>(incSeen.size()) < nPart)
+      incSeen.resize(nPart,-1);
+
+    std::vector<int> candidates;
+    candidates.swap(incNear);
+    std::vector<int> &due = incBucket[incBuild%INC_NBUCKET];
+    candidates.insert(candidates.end(),due.begin(),due.end());
+    candidates.insert(candidates.end(),incArrived.begin(),incArrived.end());
+    due.clear();
+    incArrived.clear();
+
+    const int ncand = candidates.size();
+    for(int c = 0; c < ncand; c++)
+    {
+      const int iPart = atom->map(candidates[c]);
+      if(iPart < 0 || iPart >= nPart || incSeen[iPart] == incBuild)
+        continue;
+      incSeen[iPart] = incBuild;
+      testIncrementalT<G>(iPart,treshold,x,r,skin);
+    }
+  }
+
+  template<class G>
+  void PrimitiveWall::testIncrementalT(int iPart, double treshold, double **x, double *r, double skin)
+  {
+    const double rad = r ? r[iPart] : 0.;
+
+    if(G::resolveNeighlist(x[iPart],rad,treshold,param))
+    {
+      neighlist.add(iPart);
+      incNear.push_back(atom->tag[iPart]);
+      return;
+    }
+
+    // distance to the list boundary and to the periodic boundaries
+    double delta[3];
+    double slack = G::resolveContact(x[iPart],rad,delta,param) - treshold;
+    for(int k = 0; k < 3; k++)
+    {
+      if(!domain->periodicity[k]) continue;
+      const double dlo = x[iPart][k] - domain->boxlo[k];
+      const double dhi = domain->boxhi[k] - x[iPart][k];
+      if(dlo < slack) slack = dlo;
+      if(dhi < slack) slack = dhi;
+    }
+
+    int nBuild = 1;
+    if(skin > 0. && slack >= (INC_NBUCKET-1)*skin)
+      nBuild = INC_NBUCKET-1;
+    else if(skin > 0. && slack > skin)
+      nBuild = static_cast<int>(slack/skin);
+    incBucket[(incBuild+nBuild)%INC_NBUCKET].push_back(atom->tag[iPart]);
+  }
+
   int PrimitiveWall::isNear(int iPart,double treshold)
   {
     if(resolveNeighlist(atom->x[iPart],atom->radius?atom->radius[iPart]:0.,treshold))
@@ -45,15 +45,19 @@
 #define LMP_PRIMITIVE_WALL_DEFINITIONS
 
 #include "math_extra_liggghts.h"
+#include <cmath>
 
 /*
  * Necessary steps to add new primitive walls:
  * (1) add an enum for your primitive to WallType, but insert it before NUM_WTYPE
  * (2) add a string that you want to use in your input script to wallString and
  *     the number of arguments the wall requires to numArgs
- * (3) implement distance and neighbor list build functions
- * (4) add them to the switch statements in chooseContactTemplate() and
- *     chooseNeighlistTemplate() located at the bottom of this file
+ * (3) implement distance and neighbor list build functions, the distance
+ *     must not exceed the true distance to the wall surface
+ *     (see buildNeighListIncremental())
+ * (4) register the geometry as Primitive<W> located at the bottom of this
+ *     file; setup(), axis(), radialDistance(), batch and box functions are
+ *     optional, see PrimitiveDefaults
  */
 
 namespace LAMMPS_NS
@@ -69,6 +73,15 @@ namespace LAMMPS_NS
         XCYLINDER,
         YCYLINDER,
         ZCYLINDER,
+        PLANE,
+        SPHERE,
+        BOX,
+        XCONE,
+        YCONE,
+        ZCONE,
+        XTORUS,
+        YTORUS,
+        ZTORUS,
         NUM_WTYPE
     };
 
@@ -79,7 +92,16 @@ namespace LAMMPS_NS
         "zplane",
         "xcylinder",
         "ycylinder",
-        "zcylinder"
+        "zcylinder",
+        "plane",
+        "sphere",
+        "box",
+        "xcone",
+        "ycone",
+        "zcone",
+        "xtorus",
+        "ytorus",
+        "ztorus"
     };
 
     static int numArgs[] =
@@ -89,7 +111,16 @@ namespace LAMMPS_NS
         1,
         3,
         3,
-        3
+        3,
+        6,
+        4,
+        6,
+        6,
+        6,
+        6,
+        5,
+        5,
+        5
     };
 
     /*
@@ -113,6 +144,8 @@ namespace LAMMPS_NS
      */
     inline double chooseContactTemplate(double *x, double r, double *delta, double *param, WallType wType);
     inline bool chooseNeighlistTemplate(double *x, double r, double treshold, double *param, WallType wType);
+    inline bool chooseSetup(double *param, WallType wType);
+    inline bool chooseNeighlistBoxTemplate(double *lo, double *hi, double dMax, double *param, WallType wType);
 
 /* ---------------------------------------------------------------------- */
 
@@ -126,8 +159,52 @@ namespace LAMMPS_NS
       static const int x = dim, y = (dim+1)%3, z = (dim+2)%3;
     };
 
+    /*
+     * defaults every primitive G inherits, G may hide them with own versions
+     * the batch loops call the single particle functions of G directly,
+     * so they are inlined for the concrete geometry
+     */
+    template<class G>
+    struct PrimitiveDefaults
+    {
+      static bool setup(double *param)
+      {
+        return true;
+      }
+
+      // axis for shear motion, -1 if the primitive has none
+      static int axis()
+      {
+        return -1;
+      }
+
+      // vector from the axis to the particle, -1 if the primitive has no axis
+      static double radialDistance(double *pos, double *param, double *distvec)
+      {
+        distvec[0] = distvec[1] = distvec[2] = 0.;
+        return -1.;
+      }
+
+      static bool resolveNeighlistBox(double *lo, double *hi, double dMax, double *param)
+      {
+        return true;
+      }
+
+      static void resolveNeighlistBatch(const double *pos, const double *r, int n, double treshold, double *param, int *flag)
+      {
+        for(int i = 0; i < n; i++)
+          flag[i] = G::resolveNeighlist(const_cast<double*>(pos+3*i),r?r[i]:0.,treshold,param);
+      }
+
+      static void resolveContactBatch(const double *pos, const int *idx, const double *r, int n, double *param, double *deltan, double *delta)
+      {
+        for(int k = 0; k < n; k++)
+          deltan[k] = G::resolveContact(const_cast<double*>(pos+3*idx[k]),r[k],delta+3*k,param);
+      }
+    };
+
     template<int dim>
-    struct Plane : public Dim<dim>
+    struct Plane : public Dim<dim>, public PrimitiveDefaults<Plane<dim> >
     {
       typedef Dim<dim> d;
       static double resolveContact(double *pos, double r, double *delta, double *param)
@@ -147,6 +224,37 @@ namespace LAMMPS_NS
         double absdist = (dist > 0.0) ? dist : -dist;
         return (absdist <= dMax);
       }
+      /*
+       * batch versions over contiguous positions pos[3*i+k], the loops
+       * have no branches so the compiler can vectorize them
+       */
+      static void resolveNeighlistBatch(const double *pos, const double *r, int n, double treshold, double *param, int *flag)
+      {
+        const double p = *param;
+        for(int i = 0; i < n; i++)
+        {
+          const double dist = pos[3*i+d::x] - p;
+          const double dMax = (r ? r[i] : 0.) + treshold;
+          flag[i] = (dist <= dMax) & (-dist <= dMax);
+        }
+      }
+
+      static void resolveContactBatch(const double *pos, const int *idx, const double *r, int n, double *param, double *deltan, double *delta)
+      {
+        const double p = *param;
+        for(int k = 0; k < n; k++)
+        {
+          const double dist = pos[3*idx[k]+d::x] - p;
+          deltan[k] = std::fabs(dist) - r[k];
+          delta[3*k+d::x] = -dist; delta[3*k+d::y] = 0.; delta[3*k+d::z] = 0.;
+        }
+      }
+
+      // true if the box [lo,hi] extended by dMax can touch the plane
+      static bool resolveNeighlistBox(double *lo, double *hi, double dMax, double *param)
+      {
+        return (lo[d::x] - dMax <= *param && *param <= hi[d::x] + dMax);
+      }
     };
 
 /* ---------------------------------------------------------------------- */
@@ -157,7 +265,7 @@ namespace LAMMPS_NS
      * param[2] = second coordinate of center
      */
     template<int dim>
-    struct Cylinder : public Dim<dim>
+    struct Cylinder : public Dim<dim>, public PrimitiveDefaults<Cylinder<dim> >
     {
     public:
 
@@ -169,6 +277,17 @@ namespace LAMMPS_NS
         return sqrt(dy*dy+dz*dz);
       }
 
+      static int axis()
+      {
+        return dim;
+      }
+
+      static double radialDistance(double *pos, double *param, double *distvec)
+      {
+        distvec[d::x] = 0.;
+        return calcRadialDistance(pos,param,distvec[d::y],distvec[d::z]);
+      }
+
       static double resolveContact(double *pos, double r, double *delta, double *param)
       {
         double dx, dy,dz, fact;
@@ -192,102 +311,469 @@ namespace LAMMPS_NS
         }
         return dx;
       }
+      // annular band |dist - radius| <= dMax, tested on squared distances
       static bool resolveNeighlist(double *pos, double r, double treshold, double *param)
       {
-        double dy,dz;
-        double dMax = r + treshold;
-        double dist = calcRadialDistance(pos,param,dy,dz) - *param;
-        return (dMax < dist || -dMax < dist);
+        const double dy = pos[d::y]-param[1];
+        const double dz = pos[d::z]-param[2];
+        const double rsq = dy*dy+dz*dz;
+        const double dMax = r + treshold;
+        const double rOut = *param + dMax;
+        const double rIn = *param - dMax;
+        return (rsq <= rOut*rOut && (rIn <= 0. || rsq >= rIn*rIn));
+      }
+
+      // batch versions, see Plane
+      // inside and outside the delta vector is (dy,dz)*(radius-dist)/dist
+      static void resolveNeighlistBatch(const double *pos, const double *r, int n, double treshold, double *param, int *flag)
+      {
+        for(int i = 0; i < n; i++)
+        {
+          const double dy = pos[3*i+d::y]-param[1];
+          const double dz = pos[3*i+d::z]-param[2];
+          const double rsq = dy*dy+dz*dz;
+          const double dMax = (r ? r[i] : 0.) + treshold;
+          const double rOut = *param + dMax;
+          const double rIn = *param - dMax;
+          flag[i] = (rsq <= rOut*rOut) & ((rIn <= 0.) | (rsq >= rIn*rIn));
+        }
+      }
+
+      static void resolveContactBatch(const double *pos, const int *idx, const double *r, int n, double *param, double *deltan, double *delta)
+      {
+        for(int k = 0; k < n; k++)
+        {
+          const double *p = pos + 3*idx[k];
+          const double dy = p[d::y]-param[1];
+          const double dz = p[d::z]-param[2];
+          const double dist = sqrt(dy*dy+dz*dz);
+          const bool zero = MathExtraLiggghts::compDouble(dist, 0.0);
+          const double fact = zero ? 0. : (*param - dist) / (zero ? 1. : dist);
+          deltan[k] = zero ? 0. : std::fabs(dist - *param) - r[k];
+          delta[3*k+d::x] = 0.; delta[3*k+d::y] = dy*fact; delta[3*k+d::z] = dz*fact;
+        }
+      }
+
+      // true if the box [lo,hi] extended by dMax can touch the annular band,
+      // i.e. the nearest point of the box cross-section is inside the outer
+      // radius and the farthest corner is outside the inner radius
+      static bool resolveNeighlistBox(double *lo, double *hi, double dMax, double *param)
+      {
+        double near[2], far[2];
+        const double c[2] = {param[1],param[2]};
+        const int k[2] = {d::y,d::z};
+        for(int n = 0; n < 2; n++)
+        {
+          const double l = lo[k[n]]-c[n], h = hi[k[n]]-c[n];
+          near[n] = (l > 0.) ? l : ((h < 0.) ? h : 0.);
+          far[n] = (-l > h) ? l : h;
+        }
+        const double nearsq = near[0]*near[0]+near[1]*near[1];
+        const double farsq = far[0]*far[0]+far[1]*far[1];
+        const double rOut = *param + dMax;
+        const double rIn = *param - dMax;
+        return (nearsq <= rOut*rOut && (rIn <= 0. || farsq >= rIn*rIn));
       }
 
     };
 
 /* ---------------------------------------------------------------------- */
+    /*
+     * plane with arbitrary orientation
+     * param[0-2] = normal, normalized by setup()
+     * param[3-5] = point on the plane
+     */
+    struct OrientedPlane : public PrimitiveDefaults<OrientedPlane>
+    {
+      static bool setup(double *param)
+      {
+        const double len = sqrt(param[0]*param[0]+param[1]*param[1]+param[2]*param[2]);
+        if(len <= 0.) return false;
+        param[0] /= len; param[1] /= len; param[2] /= len;
+        return true;
+      }
 
+      static double resolveContact(double *pos, double r, double *delta, double *param)
+      {
+        const double dist = (pos[0]-param[3])*param[0] + (pos[1]-param[4])*param[1] + (pos[2]-param[5])*param[2];
+        delta[0] = -dist*param[0]; delta[1] = -dist*param[1]; delta[2] = -dist*param[2];
+        return std::fabs(dist) - r;
+      }
+      static bool resolveNeighlist(double *pos, double r, double treshold, double *param)
+      {
+        const double dist = (pos[0]-param[3])*param[0] + (pos[1]-param[4])*param[1] + (pos[2]-param[5])*param[2];
+        return (std::fabs(dist) <= r + treshold);
+      }
+    };
+
+/* ---------------------------------------------------------------------- */
     /*
-     * functions to choose the correct template
+     * sphere, contact from inside or outside
+     * param[0] = radius
+     * param[1-3] = center
      */
+    struct Sphere : public PrimitiveDefaults<Sphere>
+    {
+      static bool setup(double *param)
+      {
+        return param[0] > 0.;
+      }
+
+      static double resolveContact(double *pos, double r, double *delta, double *param)
+      {
+        const double dx = pos[0]-param[1], dy = pos[1]-param[2], dz = pos[2]-param[3];
+        const double dist = sqrt(dx*dx+dy*dy+dz*dz);
+        if (MathExtraLiggghts::compDouble(dist, 0.0)) {
+            delta[0] = 0.; delta[1] = 0.; delta[2] = 0.;
+            return 0.; // break for zero dist (avoid devide-by-zero)
+        }
+        const double fact = (*param - dist) / dist;
+        delta[0] = dx*fact; delta[1] = dy*fact; delta[2] = dz*fact;
+        return std::fabs(dist - *param) - r;
+      }
+      static bool resolveNeighlist(double *pos, double r, double treshold, double *param)
+      {
+        const double dx = pos[0]-param[1], dy = pos[1]-param[2], dz = pos[2]-param[3];
+        const double rsq = dx*dx+dy*dy+dz*dz;
+        const double dMax = r + treshold;
+        const double rOut = *param + dMax;
+        const double rIn = *param - dMax;
+        return (rsq <= rOut*rOut && (rIn <= 0. || rsq >= rIn*rIn));
+      }
+    };
 
 /* ---------------------------------------------------------------------- */
+    /*
+     * axis-aligned box as a solid obstacle, particles are outside
+     * param[0-5] = xlo xhi ylo yhi zlo zhi
+     * outside, the particle touches the nearest point of the box surface;
+     * a particle center inside the box is pushed out through the nearest
+     * face only, so the box can not be used as a container - for a box
+     * shaped container use six primitive walls of type xplane/yplane/zplane
+     */
+    struct Box : public PrimitiveDefaults<Box>
+    {
+      static bool setup(double *param)
+      {
+        return param[0] < param[1] && param[2] < param[3] && param[4] < param[5];
+      }
 
-    inline double chooseContactTemplate(double *x, double r, double *delta, double *param, WallType wType)
+      static double resolveContact(double *pos, double r, double *delta, double *param)
+      {
+        bool inside = true;
+        double distsq = 0.;
+        for(int k = 0; k < 3; k++)
+        {
+          const double lo = param[2*k], hi = param[2*k+1];
+          const double c = (pos[k] < lo) ? lo : ((pos[k] > hi) ? hi : pos[k]);
+          delta[k] = c - pos[k];
+          distsq += delta[k]*delta[k];
+          if(pos[k] < lo || pos[k] > hi) inside = false;
+        }
+        if(!inside)
+          return sqrt(distsq) - r;
+
+        int kmin = 0;
+        double dmin = pos[0] - param[0], dsign = -1.;
+        for(int k = 0; k < 3; k++)
+        {
+          const double dlo = pos[k] - param[2*k], dhi = param[2*k+1] - pos[k];
+          if(dlo < dmin) { dmin = dlo; kmin = k; dsign = -1.; }
+          if(dhi < dmin) { dmin = dhi; kmin = k; dsign = 1.; }
+        }
+        // center inside: overlap is r plus the depth below the nearest
+        // face, delta points inwards so the particle is pushed out there
+        delta[0] = 0.; delta[1] = 0.; delta[2] = 0.;
+        delta[kmin] = -dsign*dmin;
+        return -(dmin + r);
+      }
+      static bool resolveNeighlist(double *pos, double r, double treshold, double *param)
+      {
+        double delta[3];
+        return (resolveContact(pos,r,delta,param) <= treshold);
+      }
+    };
+
+/* ---------------------------------------------------------------------- */
+    /*
+     * lateral surface of an axis-aligned cone or frustum
+     * param[0] = radius at lower end
+     * param[1] = radius at upper end
+     * param[2] = lower end on the axis
+     * param[3] = upper end on the axis
+     * param[4] = first coordinate of center
+     * param[5] = second coordinate of center
+     * the distance is taken to the generating segment in the meridional
+     * half-plane, so the end caps are open
+     */
+    template<int dim>
+    struct Cone : public Dim<dim>, public PrimitiveDefaults<Cone<dim> >
     {
-      //TODO: find a way to create switch statement automatically
-      switch(wType){
-      case XPLANE:
-        return Plane<0>::resolveContact(x,r,delta,param);
-      case YPLANE:
-        return Plane<1>::resolveContact(x,r,delta,param);
-      case ZPLANE:
-        return Plane<2>::resolveContact(x,r,delta,param);
-      case XCYLINDER:
-        return Cylinder<0>::resolveContact(x,r,delta,param);
-      case YCYLINDER:
-        return Cylinder<1>::resolveContact(x,r,delta,param);
-      case ZCYLINDER:
-        return Cylinder<2>::resolveContact(x,r,delta,param);
-
-      default: // default: no contact
-        return 1.;
+      typedef Dim<dim> d;
+
+      static bool setup(double *param)
+      {
+        return param[0] >= 0. && param[1] >= 0. && param[2] < param[3];
       }
+
+      static double resolveContact(double *pos, double r, double *delta, double *param)
+      {
+        double ey = pos[d::y]-param[4];
+        double ez = pos[d::z]-param[5];
+        const double rho = sqrt(ey*ey+ez*ez);
+        if (MathExtraLiggghts::compDouble(rho, 0.0)) {
+            ey = 1.; ez = 0.; // any radial direction on the axis
+        } else {
+            ey /= rho; ez /= rho;
+        }
+
+        // closest point on the segment (param[2],param[0]) - (param[3],param[1])
+        const double sa = param[3]-param[2], sr = param[1]-param[0];
+        double t = ((pos[d::x]-param[2])*sa + (rho-param[0])*sr) / (sa*sa+sr*sr);
+        t = (t < 0.) ? 0. : ((t > 1.) ? 1. : t);
+        const double da = param[2] + t*sa - pos[d::x];
+        const double dr = param[0] + t*sr - rho;
+
+        delta[d::x] = da; delta[d::y] = dr*ey; delta[d::z] = dr*ez;
+        return sqrt(da*da+dr*dr) - r;
+      }
+      static bool resolveNeighlist(double *pos, double r, double treshold, double *param)
+      {
+        double delta[3];
+        return (resolveContact(pos,r,delta,param) <= treshold);
+      }
+    };
+
+/* ---------------------------------------------------------------------- */
+    /*
+     * axis-aligned torus
+     * param[0] = major radius
+     * param[1] = minor radius
+     * param[2-4] = center
+     */
+    template<int dim>
+    struct Torus : public Dim<dim>, public PrimitiveDefaults<Torus<dim> >
+    {
+      typedef Dim<dim> d;
+
+      static bool setup(double *param)
+      {
+        return param[0] > 0. && param[1] > 0.;
+      }
+
+      static double resolveContact(double *pos, double r, double *delta, double *param)
+      {
+        const double da = pos[d::x]-param[2+d::x];
+        double ey = pos[d::y]-param[2+d::y];
+        double ez = pos[d::z]-param[2+d::z];
+        const double rho = sqrt(ey*ey+ez*ez);
+        if (MathExtraLiggghts::compDouble(rho, 0.0)) {
+            ey = 1.; ez = 0.; // any radial direction on the axis
+        } else {
+            ey /= rho; ez /= rho;
+        }
+
+        // vector from the particle to the nearest point of the tube center circle
+        const double va = -da, vr = *param - rho;
+        const double q = sqrt(va*va+vr*vr);
+        if (MathExtraLiggghts::compDouble(q, 0.0)) {
+            delta[0] = 0.; delta[1] = 0.; delta[2] = 0.;
+            return 0.; // break for zero dist (avoid devide-by-zero)
+        }
+        const double fact = (q - param[1]) / q;
+        delta[d::x] = va*fact; delta[d::y] = vr*fact*ey; delta[d::z] = vr*fact*ez;
+        return std::fabs(q - param[1]) - r;
+      }
+      static bool resolveNeighlist(double *pos, double r, double treshold, double *param)
+      {
+        double delta[3];
+        return (resolveContact(pos,r,delta,param) <= treshold);
+      }
+    };
+
+/* ---------------------------------------------------------------------- */
+
+    /*
+     * registry of the primitives: maps each WallType to its geometry
+     */
+
+    template<WallType W> struct Primitive;
+    template<> struct Primitive<XPLANE>    { typedef Plane<0> type; };
+    template<> struct Primitive<YPLANE>    { typedef Plane<1> type; };
+    template<> struct Primitive<ZPLANE>    { typedef Plane<2> type; };
+    template<> struct Primitive<XCYLINDER> { typedef Cylinder<0> type; };
+    template<> struct Primitive<YCYLINDER> { typedef Cylinder<1> type; };
+    template<> struct Primitive<ZCYLINDER> { typedef Cylinder<2> type; };
+    template<> struct Primitive<PLANE>     { typedef OrientedPlane type; };
+    template<> struct Primitive<SPHERE>    { typedef Sphere type; };
+    template<> struct Primitive<BOX>       { typedef Box type; };
+    template<> struct Primitive<XCONE>     { typedef Cone<0> type; };
+    template<> struct Primitive<YCONE>     { typedef Cone<1> type; };
+    template<> struct Primitive<ZCONE>     { typedef Cone<2> type; };
+    template<> struct Primitive<XTORUS>    { typedef Torus<0> type; };
+    template<> struct Primitive<YTORUS>    { typedef Torus<1> type; };
+    template<> struct Primitive<ZTORUS>    { typedef Torus<2> type; };
+
+    /*
+     * walks the wall types at compile time and calls op.run<W>() for the
+     * matching one, op.fallback() if there is none
+     * callers dispatch once and loop inside run<W>(), so the loop is
+     * instantiated for each geometry
+     */
+
+    template<int W>
+    struct WallTypeRegistry
+    {
+      template<typename Op>
+      static void dispatch(WallType wType, Op &op)
+      {
+        if(wType == W) op.template run<(WallType)W>();
+        else WallTypeRegistry<W+1>::dispatch(wType,op);
+      }
+    };
+
+    template<>
+    struct WallTypeRegistry<NUM_WTYPE>
+    {
+      template<typename Op>
+      static void dispatch(WallType wType, Op &op)
+      {
+        op.fallback();
+      }
+    };
+
+    template<typename Op>
+    inline void dispatchWallType(WallType wType, Op &op)
+    {
+      WallTypeRegistry<0>::dispatch(wType,op);
+    }
+
+/* ---------------------------------------------------------------------- */
+
+    /*
+     * functions to choose the correct template, generated from the registry
+     */
+
+    struct ContactOp
+    {
+      double *x, r, *delta, *param, result;
+      template<WallType W> void run() { result = Primitive<W>::type::resolveContact(x,r,delta,param); }
+      void fallback() { result = 1.; } // no contact
+    };
+
+    struct NeighlistOp
+    {
+      double *x, r, treshold, *param;
+      bool result;
+      template<WallType W> void run() { result = Primitive<W>::type::resolveNeighlist(x,r,treshold,param); }
+      void fallback() { result = true; } // every particle will be added to neighbor list
+    };
+
+    struct SetupOp
+    {
+      double *param;
+      bool result;
+      template<WallType W> void run() { result = Primitive<W>::type::setup(param); }
+      void fallback() { result = true; }
+    };
+
+    struct NeighlistBoxOp
+    {
+      double *lo, *hi, dMax, *param;
+      bool result;
+      template<WallType W> void run() { result = Primitive<W>::type::resolveNeighlistBox(lo,hi,dMax,param); }
+      void fallback() { result = true; } // box may touch the wall
+    };
+
+    struct NeighlistBatchOp
+    {
+      const double *pos, *r;
+      int n;
+      double treshold, *param;
+      int *flag;
+      template<WallType W> void run() { Primitive<W>::type::resolveNeighlistBatch(pos,r,n,treshold,param,flag); }
+      void fallback() { for(int i = 0; i < n; i++) flag[i] = 1; }
+    };
+
+    struct AxisOp
+    {
+      int result;
+      template<WallType W> void run() { result = Primitive<W>::type::axis(); }
+      void fallback() { result = -1; }
+    };
+
+    struct RadialDistanceOp
+    {
+      double *pos, *param, *distvec, result;
+      template<WallType W> void run() { result = Primitive<W>::type::radialDistance(pos,param,distvec); }
+      void fallback() { distvec[0] = distvec[1] = distvec[2] = 0.; result = -1.; }
+    };
+
+    struct ContactBatchOp
+    {
+      const double *pos;
+      const int *idx;
+      const double *r;
+      int n;
+      double *param, *deltan, *delta;
+      template<WallType W> void run() { Primitive<W>::type::resolveContactBatch(pos,idx,r,n,param,deltan,delta); }
+      void fallback() { for(int k = 0; k < n; k++) deltan[k] = 1.; }
+    };
+
+    inline double chooseContactTemplate(double *x, double r, double *delta, double *param, WallType wType)
+    {
+      ContactOp op = {x,r,delta,param,1.};
+      dispatchWallType(wType,op);
+      return op.result;
     }
 
     inline bool chooseNeighlistTemplate(double *x, double r, double treshold, double *param, WallType wType)
     {
-      //TODO: create switch statement automatically
-      switch(wType){
-      case XPLANE:
-        return Plane<0>::resolveNeighlist(x,r,treshold,param);
-      case YPLANE:
-        return Plane<1>::resolveNeighlist(x,r,treshold,param);
-      case ZPLANE:
-        return Plane<2>::resolveNeighlist(x,r,treshold,param);
-      case XCYLINDER:
-        return Cylinder<0>::resolveNeighlist(x,r,treshold,param);
-      case YCYLINDER:
-        return Cylinder<1>::resolveNeighlist(x,r,treshold,param);
-      case ZCYLINDER:
-        return Cylinder<2>::resolveNeighlist(x,r,treshold,param);
-
-      default: // default value: every particle will be added to neighbor list
-        return true;
-      }
+      NeighlistOp op = {x,r,treshold,param,true};
+      dispatchWallType(wType,op);
+      return op.result;
     }
 
-    inline int chooseAxis(WallType wType)
+    // checks the parameters and brings them into the form used by the
+    // primitive, e.g. normalizes directions; returns false if invalid
+    inline bool chooseSetup(double *param, WallType wType)
     {
-      //TODO: create switch statement automatically
-      switch(wType){
-      case XCYLINDER:
-        return 0;
-      case YCYLINDER:
-        return 1;
-      case ZCYLINDER:
-        return 2;
+      SetupOp op = {param,true};
+      dispatchWallType(wType,op);
+      return op.result;
+    }
 
-      default:
-        return -1;
-      }
+    inline void chooseNeighlistBatchTemplate(const double *pos, const double *r, int n, double treshold, double *param, int *flag, WallType wType)
+    {
+      NeighlistBatchOp op = {pos,r,n,treshold,param,flag};
+      dispatchWallType(wType,op);
     }
 
-    inline double chooseCalcRadialDistance(double *pos, double *param, double &dx, double &dy, double &dz, WallType wType)
-    {
-      //TODO: create switch statement automatically
-      switch(wType){
-      case XCYLINDER:
-        dx=0.;
-        return Cylinder<0>::calcRadialDistance(pos,param,dy,dz);
-      case YCYLINDER:
-        dy = 0.;
-        return Cylinder<1>::calcRadialDistance(pos,param,dx,dz);
-      case ZCYLINDER:
-        dz = 0.;
-        return Cylinder<2>::calcRadialDistance(pos,param,dx,dy);
-
-      default:
-        dx = dy = dz = 0.;
-        return -1.;
-      }
+    inline void chooseContactBatchTemplate(const double *pos, const int *idx, const double *r, int n, double *param, double *deltan, double *delta, WallType wType)
+    {
+      ContactBatchOp op = {pos,idx,r,n,param,deltan,delta};
+      dispatchWallType(wType,op);
+    }
+
+    inline bool chooseNeighlistBoxTemplate(double *lo, double *hi, double dMax, double *param, WallType wType)
+    {
+      NeighlistBoxOp op = {lo,hi,dMax,param,true};
+      dispatchWallType(wType,op);
+      return op.result;
+    }
+
+    inline int chooseAxis(WallType wType)
+    {
+      AxisOp op = {-1};
+      dispatchWallType(wType,op);
+      return op.result;
+    }
+
+    inline double chooseCalcRadialDistance(double *pos, double *param, double *distvec, WallType wType)
+    {
+      RadialDistanceOp op = {pos,param,distvec,-1.};
+      dispatchWallType(wType,op);
+      return op.result;
     }
 
     inline int chooseNumArgs(char *style)